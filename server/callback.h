@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <functional>
+#include <type_traits>
+
+//回调内联缓冲区大小(字节)，超过该大小或移动可能抛异常的可调用对象放到堆上
+#ifndef SERVER_CALLBACK_INLINE_SIZE
+#define SERVER_CALLBACK_INLINE_SIZE 56
+#endif
+
+namespace server {
+
+template<class Signature, size_t InlineSize = SERVER_CALLBACK_INLINE_SIZE>
+class InlineFunction;
+
+//带小缓冲区优化的可调用对象，替代调度队列、事件、定时器中的std::function
+//捕获内容不超过InlineSize的lambda直接存放在对象内部，构造、移动都不分配内存
+//只能移动不能复制，可以保存只能移动的可调用对象
+template<class R, class... Args, size_t InlineSize>
+class InlineFunction<R(Args...), InlineSize> {
+private:
+    static_assert(InlineSize >= sizeof(void*), "InlineSize must hold a pointer");
+    typedef typename std::aligned_storage<InlineSize, alignof(void*)>::type Storage;
+
+    struct Ops {
+        R (*invoke)(void* obj, Args&&... args);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* obj);
+    };
+
+    template<class F>
+    struct IsInline {
+        static const bool value = sizeof(F) <= InlineSize
+            && alignof(F) <= alignof(Storage)
+            && std::is_nothrow_move_constructible<F>::value;
+    };
+
+    //对象存放在缓冲区内
+    template<class F>
+    struct InlineOps {
+        static R Invoke(void* obj, Args&&... args) {
+            return (*static_cast<F*>(obj))(std::forward<Args>(args)...);
+        }
+        static void Move(void* dst, void* src) {
+            F* f = static_cast<F*>(src);
+            new (dst) F(std::move(*f));
+            f->~F();
+        }
+        static void Destroy(void* obj) {
+            static_cast<F*>(obj)->~F();
+        }
+        static const Ops* Get() {
+            static const Ops s_ops = { &Invoke, &Move, &Destroy };
+            return &s_ops;
+        }
+    };
+
+    //缓冲区内只存放指向堆对象的指针
+    template<class F>
+    struct HeapOps {
+        static F*& Ptr(void* obj) { return *static_cast<F**>(obj); }
+        static R Invoke(void* obj, Args&&... args) {
+            return (*Ptr(obj))(std::forward<Args>(args)...);
+        }
+        static void Move(void* dst, void* src) {
+            *static_cast<F**>(dst) = Ptr(src);
+            Ptr(src) = nullptr;
+        }
+        static void Destroy(void* obj) {
+            delete Ptr(obj);
+        }
+        static const Ops* Get() {
+            static const Ops s_ops = { &Invoke, &Move, &Destroy };
+            return &s_ops;
+        }
+    };
+
+    template<class T>
+    static bool IsNull(const T&) { return false; }
+    template<class T>
+    static bool IsNull(T* p) { return !p; }
+    template<class S>
+    static bool IsNull(const std::function<S>& f) { return !f; }
+public:
+    typedef InlineFunction<R(Args...), InlineSize> type;
+
+    InlineFunction() {}
+    InlineFunction(std::nullptr_t) {}
+
+    template<class F, class D = typename std::decay<F>::type,
+             class = typename std::enable_if<!std::is_same<D, InlineFunction>::value>::type,
+             class = decltype(std::declval<D&>()(std::declval<Args>()...))>
+    InlineFunction(F&& f) {
+        if(IsNull(f)) {
+            return;
+        }
+        init<D>(std::forward<F>(f), std::integral_constant<bool, IsInline<D>::value>());
+    }
+
+    InlineFunction(const InlineFunction&) = delete;
+    InlineFunction& operator=(const InlineFunction&) = delete;
+
+    InlineFunction(InlineFunction&& oth) noexcept {
+        if(oth.m_ops) {
+            oth.m_ops->move(&m_storage, &oth.m_storage);
+            m_ops = oth.m_ops;
+            oth.m_ops = nullptr;
+        }
+    }
+
+    ~InlineFunction() {
+        clear();
+    }
+
+    InlineFunction& operator=(InlineFunction&& oth) noexcept {
+        if(this != &oth) {
+            clear();
+            if(oth.m_ops) {
+                oth.m_ops->move(&m_storage, &oth.m_storage);
+                m_ops = oth.m_ops;
+                oth.m_ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    InlineFunction& operator=(std::nullptr_t) {
+        clear();
+        return *this;
+    }
+
+    template<class F, class D = typename std::decay<F>::type,
+             class = typename std::enable_if<!std::is_same<D, InlineFunction>::value>::type,
+             class = decltype(std::declval<D&>()(std::declval<Args>()...))>
+    InlineFunction& operator=(F&& f) {
+        InlineFunction tmp(std::forward<F>(f));
+        *this = std::move(tmp);
+        return *this;
+    }
+
+    void swap(InlineFunction& oth) {
+        InlineFunction tmp(std::move(oth));
+        oth = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    explicit operator bool() const { return m_ops != nullptr; }
+
+    R operator()(Args... args) const {
+        if(!m_ops) {
+            throw std::bad_function_call();
+        }
+        return m_ops->invoke(const_cast<Storage*>(&m_storage), std::forward<Args>(args)...);
+    }
+
+    //可调用对象是否存放在内联缓冲区中
+    template<class F>
+    static constexpr bool FitsInline() { return IsInline<typename std::decay<F>::type>::value; }
+private:
+    template<class D, class F>
+    void init(F&& f, std::true_type) {
+        new (&m_storage) D(std::forward<F>(f));
+        m_ops = InlineOps<D>::Get();
+    }
+
+    template<class D, class F>
+    void init(F&& f, std::false_type) {
+        *reinterpret_cast<D**>(&m_storage) = new D(std::forward<F>(f));
+        m_ops = HeapOps<D>::Get();
+    }
+
+    void clear() {
+        if(m_ops) {
+            m_ops->destroy(&m_storage);
+            m_ops = nullptr;
+        }
+    }
+private:
+    Storage m_storage;
+    const Ops* m_ops = nullptr;
+};
+
+typedef InlineFunction<void()> Callback;
+
+}
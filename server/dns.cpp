@@ -0,0 +1,569 @@
+#include "dns.h"
+#include "scheduler.h"
+#include "config.h"
+#include "hook.h"
+#include "log.h"
+#include "util.h"
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <algorithm>
+#include <string.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+namespace server {
+
+static Logger::ptr g_logger = SERVER_LOG_NAME("system");
+
+static ConfigVar<std::vector<std::string> >::ptr g_dns_nameservers =
+    Config::Lookup<std::vector<std::string> >("dns.nameservers", std::vector<std::string>(), "nameservers as ip[:port], empty uses resolv.conf");
+static ConfigVar<std::string>::ptr g_dns_resolv_conf =
+    Config::Lookup<std::string>("dns.resolv_conf", "/etc/resolv.conf", "resolv.conf path");
+static ConfigVar<std::string>::ptr g_dns_hosts =
+    Config::Lookup<std::string>("dns.hosts", "/etc/hosts", "hosts file path");
+static ConfigVar<uint32_t>::ptr g_dns_timeout_ms =
+    Config::Lookup<uint32_t>("dns.timeout_ms", 0, "per query timeout in ms, 0 uses resolv.conf options timeout");
+static ConfigVar<uint32_t>::ptr g_dns_negative_ttl =
+    Config::Lookup<uint32_t>("dns.negative_ttl", 30, "seconds to cache a nonexistent name");
+static ConfigVar<uint32_t>::ptr g_dns_cache_max =
+    Config::Lookup<uint32_t>("dns.cache_max", 10000, "max cached names");
+
+static const uint16_t s_dns_type_a = 1;
+static const uint16_t s_dns_class_in = 1;
+static const size_t s_dns_header_size = 12;
+static const size_t s_dns_max_packet = 1232;
+
+static std::string NormalizeName(const std::string& host) {
+    std::string name = host;
+    if(!name.empty() && name.back() == '.') {
+        name.pop_back();
+    }
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    return name;
+}
+
+//"ip"或"ip:port"
+static bool ParseNameserver(const std::string& str, sockaddr_in& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(53);
+    std::string ip = str;
+    size_t pos = str.find(':');
+    if(pos != std::string::npos) {
+        ip = str.substr(0, pos);
+        addr.sin_port = htons(atoi(str.c_str() + pos + 1));
+    }
+    return inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) == 1;
+}
+
+static uint16_t ReadU16(const uint8_t* p) {
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t ReadU32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+//读取pos处的名字(支持压缩指针), pos移到名字之后
+static bool ReadName(const uint8_t* buf, size_t len, size_t& pos, std::string& name) {
+    name.clear();
+    size_t cur = pos;
+    bool jumped = false;
+    for(int hops = 0; hops < 64; ++hops) {
+        if(cur >= len) {
+            return false;
+        }
+        uint8_t c = buf[cur];
+        if((c & 0xC0) == 0xC0) {
+            if(cur + 1 >= len) {
+                return false;
+            }
+            if(!jumped) {
+                pos = cur + 2;
+                jumped = true;
+            }
+            cur = ((c & 0x3F) << 8) | buf[cur + 1];
+            continue;
+        }
+        if(c > 63 || cur + 1 + c > len) {
+            return false;
+        }
+        if(c == 0) {
+            if(!jumped) {
+                pos = cur + 1;
+            }
+            return true;
+        }
+        if(!name.empty()) {
+            name.push_back('.');
+        }
+        for(size_t i = 0; i < c; ++i) {
+            name.push_back(::tolower(buf[cur + 1 + i]));
+        }
+        cur += 1 + c;
+    }
+    return false;
+}
+
+//等待sock可读/写, 超过end_ms返回false
+static bool WaitSocket(int sock, short events, uint64_t end_ms) {
+    while(true) {
+        uint64_t now_ms = GetCurrentMS();
+        if(now_ms >= end_ms) {
+            return false;
+        }
+        struct pollfd pfd = {sock, events, 0};
+        int rt = poll(&pfd, 1, end_ms - now_ms);
+        if(rt > 0) {
+            return true;
+        }
+        if(rt < 0 && errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+static bool WriteFull(int sock, const char* data, size_t len, uint64_t end_ms) {
+    while(len) {
+        ssize_t n = send(sock, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(n > 0) {
+            data += n;
+            len -= n;
+        } else if(n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            if(!WaitSocket(sock, POLLOUT, end_ms)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ReadFull(int sock, char* data, size_t len, uint64_t end_ms) {
+    while(len) {
+        ssize_t n = recv(sock, data, len, MSG_DONTWAIT);
+        if(n > 0) {
+            data += n;
+            len -= n;
+        } else if(n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            if(!WaitSocket(sock, POLLIN, end_ms)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool BuildQuery(const std::string& name, uint16_t id, std::string& out) {
+    out.clear();
+    uint8_t header[s_dns_header_size] = {
+        (uint8_t)(id >> 8), (uint8_t)id,
+        0x01, 0x00,     //RD
+        0x00, 0x01,     //QDCOUNT
+        0, 0, 0, 0, 0, 0
+    };
+    out.append((const char*)header, sizeof(header));
+    std::stringstream ss(name);
+    std::string label;
+    while(std::getline(ss, label, '.')) {
+        if(label.empty() || label.size() > 63) {
+            return false;
+        }
+        out.push_back((char)label.size());
+        out.append(label);
+    }
+    out.push_back('\0');
+    if(out.size() - s_dns_header_size > 255) {
+        return false;
+    }
+    const uint8_t tail[4] = {0, s_dns_type_a, 0, s_dns_class_in};
+    out.append((const char*)tail, sizeof(tail));
+    return true;
+}
+
+//解析应答, id或问题不匹配返回1(忽略该包继续等待), 否则返回0或EAI_*(负数)
+//truncated: 应答带TC标志, 记录不完整
+static int ParseResponse(const uint8_t* buf, size_t len, uint16_t id, const std::string& name,
+                         std::vector<in_addr>& addrs, uint32_t& ttl, bool& truncated) {
+    if(len < s_dns_header_size || ReadU16(buf) != id || !(buf[2] & 0x80)) {
+        return 1;
+    }
+    uint16_t qdcount = ReadU16(buf + 4);
+    uint16_t ancount = ReadU16(buf + 6);
+    size_t pos = s_dns_header_size;
+    std::string qname;
+    if(qdcount != 1 || !ReadName(buf, len, pos, qname) || qname != name || pos + 4 > len) {
+        return 1;
+    }
+    pos += 4;
+
+    truncated = buf[2] & 0x02;
+    int rcode = buf[3] & 0x0F;
+    if(rcode == 3) {
+        return EAI_NONAME;
+    }
+    if(rcode != 0) {
+        return EAI_AGAIN;
+    }
+    //CNAME链上的A记录一般随应答一起返回, 收集所有A记录
+    ttl = (uint32_t)-1;
+    std::string rname;
+    for(uint16_t i = 0; i < ancount; ++i) {
+        if(!ReadName(buf, len, pos, rname) || pos + 10 > len) {
+            return EAI_FAIL;
+        }
+        uint16_t type = ReadU16(buf + pos);
+        uint16_t cls = ReadU16(buf + pos + 2);
+        uint32_t rttl = ReadU32(buf + pos + 4);
+        uint16_t rdlen = ReadU16(buf + pos + 8);
+        pos += 10;
+        if(pos + rdlen > len) {
+            return EAI_FAIL;
+        }
+        if(type == s_dns_type_a && cls == s_dns_class_in && rdlen == 4) {
+            in_addr addr;
+            memcpy(&addr, buf + pos, 4);
+            addrs.push_back(addr);
+            ttl = std::min(ttl, rttl);
+        }
+        pos += rdlen;
+    }
+    return addrs.empty() ? EAI_NONAME : 0;
+}
+
+DnsResolver::DnsResolver() {
+    loadResolvConf();
+    reloadHosts();
+}
+
+void DnsResolver::loadResolvConf() {
+    std::ifstream ifs(g_dns_resolv_conf->getValue());
+    std::string line;
+    while(std::getline(ifs, line)) {
+        std::stringstream ss(line);
+        std::string key;
+        ss >> key;
+        if(key == "nameserver") {
+            std::string ip;
+            ss >> ip;
+            sockaddr_in addr;
+            //IPv6的nameserver暂不支持
+            if(m_nameservers.size() < 3 && ParseNameserver(ip, addr)) {
+                m_nameservers.push_back(addr);
+            }
+        } else if(key == "options") {
+            std::string opt;
+            while(ss >> opt) {
+                if(opt.compare(0, 8, "timeout:") == 0) {
+                    m_timeoutMs = atoi(opt.c_str() + 8) * 1000;
+                } else if(opt.compare(0, 9, "attempts:") == 0) {
+                    m_attempts = atoi(opt.c_str() + 9);
+                }
+            }
+        }
+    }
+    if(!m_attempts) {
+        m_attempts = 1;
+    }
+    if(m_nameservers.empty()) {
+        //与glibc一致, 没有配置时使用本机
+        sockaddr_in addr;
+        ParseNameserver("127.0.0.1", addr);
+        m_nameservers.push_back(addr);
+    }
+}
+
+void DnsResolver::reloadHosts() {
+    std::unordered_map<std::string, std::vector<in_addr> > hosts;
+    std::ifstream ifs(g_dns_hosts->getValue());
+    std::string line;
+    while(std::getline(ifs, line)) {
+        size_t pos = line.find('#');
+        if(pos != std::string::npos) {
+            line.resize(pos);
+        }
+        std::stringstream ss(line);
+        std::string ip;
+        in_addr addr;
+        if(!(ss >> ip) || inet_pton(AF_INET, ip.c_str(), &addr) != 1) {
+            continue;
+        }
+        std::string name;
+        while(ss >> name) {
+            hosts[NormalizeName(name)].push_back(addr);
+        }
+    }
+    MutexType::Lock lock(m_mutex);
+    m_hosts.swap(hosts);
+}
+
+void DnsResolver::clearCache() {
+    MutexType::Lock lock(m_mutex);
+    m_cache.clear();
+}
+
+std::vector<sockaddr_in> DnsResolver::getNameservers() {
+    std::vector<std::string> conf = g_dns_nameservers->getValue();
+    if(conf.empty()) {
+        return m_nameservers;
+    }
+    std::vector<sockaddr_in> servers;
+    for(auto& i : conf) {
+        sockaddr_in addr;
+        if(ParseNameserver(i, addr)) {
+            servers.push_back(addr);
+        } else {
+            SERVER_LOG_ERROR(g_logger) << "invalid dns.nameservers item: " << i;
+        }
+    }
+    return servers;
+}
+
+int DnsResolver::resolve(const std::string& host, std::vector<in_addr>& addrs) {
+    addrs.clear();
+    in_addr numeric;
+    if(inet_pton(AF_INET, host.c_str(), &numeric) == 1) {
+        addrs.push_back(numeric);
+        return 0;
+    }
+    std::string name = NormalizeName(host);
+    if(name.empty()) {
+        return EAI_NONAME;
+    }
+
+    Scheduler* scheduler = Scheduler::GetThis();
+    //只有在开启hook的调度线程中才能挂起等待, 其他线程各自查询
+    bool can_wait = scheduler && is_hook_enable() && Fiber::GetThisRaw() != Scheduler::GetMainFiber();
+    std::shared_ptr<Pending> pending;
+    std::shared_ptr<Pending> owned;
+    {
+        MutexType::Lock lock(m_mutex);
+        auto hit = m_hosts.find(name);
+        if(hit != m_hosts.end()) {
+            addrs = hit->second;
+            return 0;
+        }
+        auto it = m_cache.find(name);
+        if(it != m_cache.end()) {
+            if(it->second.expireMs > GetCurrentMS()) {
+                ++m_cacheHits;
+                addrs = it->second.addrs;
+                return it->second.error;
+            }
+            m_cache.erase(it);
+        }
+        auto pit = m_pending.find(name);
+        if(pit != m_pending.end() && can_wait) {
+            pending = pit->second;
+            pending->waiters.push_back(std::make_pair(scheduler, Fiber::GetThis()));
+        } else if(pit == m_pending.end()) {
+            owned.reset(new Pending);
+            m_pending[name] = owned;
+        }
+    }
+
+    if(pending) {
+        ++m_coalesced;
+        scheduler->addExternalWait();
+        Fiber::YieldToHold();
+        addrs = pending->addrs;
+        return pending->error;
+    }
+
+    uint32_t ttl = 0;
+    int error = query(name, addrs, ttl);
+    putCache(name, error, addrs, ttl);
+    //不能等待而自行查询的线程不持有pending, 不能唤醒其他查询的等待者
+    if(!owned) {
+        return error;
+    }
+
+    std::vector<std::pair<Scheduler*, Fiber::ptr> > waiters;
+    {
+        MutexType::Lock lock(m_mutex);
+        owned->error = error;
+        owned->addrs = addrs;
+        waiters.swap(owned->waiters);
+        auto pit = m_pending.find(name);
+        if(pit != m_pending.end() && pit->second == owned) {
+            m_pending.erase(pit);
+        }
+    }
+    for(auto& i : waiters) {
+        i.first->schedule(std::move(i.second));
+        i.first->delExternalWait();
+    }
+    return error;
+}
+
+void DnsResolver::putCache(const std::string& name, int error, const std::vector<in_addr>& addrs, uint32_t ttl) {
+    if(error == EAI_NONAME) {
+        ttl = g_dns_negative_ttl->getValue();
+    } else if(error || !ttl) {
+        //超时等临时错误及ttl为0的结果不缓存
+        return;
+    }
+    uint64_t now_ms = GetCurrentMS();
+    MutexType::Lock lock(m_mutex);
+    if(m_cache.size() >= g_dns_cache_max->getValue()) {
+        for(auto it = m_cache.begin(); it != m_cache.end();) {
+            if(it->second.expireMs <= now_ms) {
+                it = m_cache.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if(m_cache.size() >= g_dns_cache_max->getValue()) {
+            m_cache.clear();
+        }
+    }
+    Entry& entry = m_cache[name];
+    entry.error = error;
+    entry.addrs = addrs;
+    entry.expireMs = now_ms + (uint64_t)ttl * 1000;
+}
+
+int DnsResolver::query(const std::string& name, std::vector<in_addr>& addrs, uint32_t& ttl) {
+    std::vector<sockaddr_in> servers = getNameservers();
+    uint64_t timeout_ms = g_dns_timeout_ms->getValue();
+    if(!timeout_ms) {
+        timeout_ms = m_timeoutMs;
+    }
+    ++m_queryCount;
+    int error = EAI_AGAIN;
+    for(uint32_t attempt = 0; attempt < m_attempts; ++attempt) {
+        for(auto& ns : servers) {
+            error = queryServer(ns, name, timeout_ms, addrs, ttl);
+            if(error != EAI_AGAIN) {
+                return error;
+            }
+        }
+    }
+    return error;
+}
+
+int DnsResolver::queryServer(const sockaddr_in& ns, const std::string& name, uint64_t timeout_ms,
+                             std::vector<in_addr>& addrs, uint32_t& ttl) {
+    static thread_local std::mt19937 s_rand(std::random_device{}());
+    uint16_t id = s_rand();
+    std::string packet;
+    if(!BuildQuery(name, id, packet)) {
+        return EAI_NONAME;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sock < 0) {
+        SERVER_LOG_ERROR(g_logger) << "dns socket errno=" << errno << " " << strerror(errno);
+        return EAI_FAIL;
+    }
+    int error = EAI_AGAIN;
+    //connect后内核只接收该nameserver的应答
+    if(connect(sock, (const sockaddr*)&ns, sizeof(ns)) || send(sock, packet.data(), packet.size(), 0) < 0) {
+        SERVER_LOG_WARN(g_logger) << "dns send to " << inet_ntoa(ns.sin_addr) << ":" << ntohs(ns.sin_port)
+            << " errno=" << errno << " " << strerror(errno);
+        close(sock);
+        return error;
+    }
+
+    uint8_t buf[s_dns_max_packet];
+    uint64_t end_ms = GetCurrentMS() + timeout_ms;
+    while(true) {
+        uint64_t now_ms = GetCurrentMS();
+        if(now_ms >= end_ms) {
+            break;
+        }
+        //hook后的poll挂起协程, 对不匹配的应答继续等到剩余时间
+        struct pollfd pfd = {sock, POLLIN, 0};
+        int rt = poll(&pfd, 1, end_ms - now_ms);
+        if(rt < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if(rt == 0) {
+            continue;
+        }
+        ssize_t n = recv(sock, buf, sizeof(buf), MSG_DONTWAIT);
+        if(n < 0) {
+            if(errno == EAGAIN || errno == EINTR) {
+                continue;
+            }
+            //ECONNREFUSED: 对端没有监听
+            break;
+        }
+        addrs.clear();
+        bool truncated = false;
+        rt = ParseResponse(buf, n, id, name, addrs, ttl, truncated);
+        if(rt > 0) {
+            continue;
+        }
+        error = rt;
+        if(truncated) {
+            //应答被截断, 改用TCP重新查询完整结果
+            std::vector<in_addr> tcp_addrs;
+            uint32_t tcp_ttl = 0;
+            int tcp_error = queryServerTcp(ns, name, packet, id, end_ms, tcp_addrs, tcp_ttl);
+            if(tcp_error != EAI_AGAIN) {
+                error = tcp_error;
+                addrs.swap(tcp_addrs);
+                ttl = tcp_ttl;
+            } else if(!addrs.empty()) {
+                //TCP失败时先用截断应答中已有的记录, ttl置0不缓存
+                error = 0;
+                ttl = 0;
+            } else {
+                error = EAI_AGAIN;
+            }
+        }
+        break;
+    }
+    close(sock);
+    return error;
+}
+
+int DnsResolver::queryServerTcp(const sockaddr_in& ns, const std::string& name, const std::string& packet,
+                                uint16_t id, uint64_t end_ms, std::vector<in_addr>& addrs, uint32_t& ttl) {
+    uint64_t now_ms = GetCurrentMS();
+    if(now_ms >= end_ms) {
+        return EAI_AGAIN;
+    }
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if(sock < 0) {
+        SERVER_LOG_ERROR(g_logger) << "dns tcp socket errno=" << errno << " " << strerror(errno);
+        return EAI_AGAIN;
+    }
+    if(connect_with_timeout(sock, (const sockaddr*)&ns, sizeof(ns), end_ms - now_ms)) {
+        SERVER_LOG_WARN(g_logger) << "dns tcp connect to " << inet_ntoa(ns.sin_addr) << ":" << ntohs(ns.sin_port)
+            << " errno=" << errno << " " << strerror(errno);
+        close(sock);
+        return EAI_AGAIN;
+    }
+    //TCP报文前带2字节长度
+    std::string req;
+    req.push_back((char)(packet.size() >> 8));
+    req.push_back((char)packet.size());
+    req.append(packet);
+    int error = EAI_AGAIN;
+    uint8_t len_buf[2];
+    if(WriteFull(sock, req.data(), req.size(), end_ms)
+            && ReadFull(sock, (char*)len_buf, sizeof(len_buf), end_ms)) {
+        std::string resp(ReadU16(len_buf), '\0');
+        if(ReadFull(sock, &resp[0], resp.size(), end_ms)) {
+            bool truncated = false;
+            addrs.clear();
+            int rt = ParseResponse((const uint8_t*)resp.data(), resp.size(), id, name, addrs, ttl, truncated);
+            if(rt <= 0) {
+                error = rt;
+            }
+        }
+    }
+    close(sock);
+    return error;
+}
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <netinet/in.h>
+#include "thread.h"
+#include "fiber.h"
+#include "singleton.h"
+#include "noncopyable.h"
+
+namespace server {
+
+class Scheduler;
+
+//协程DNS解析器(IPv4 A记录)
+//依次查/etc/hosts、缓存, 未命中时通过hook后的UDP socket向resolv.conf中的nameserver查询, 协程挂起不阻塞线程
+//结果按TTL缓存, 同一名字的并发查询只发一次, 其余协程等待第一个查询的结果
+class DnsResolver : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    DnsResolver();
+
+    //解析host, 成功返回0; 名字不存在返回EAI_NONAME, 超时或服务器失败返回EAI_AGAIN, 其他错误返回EAI_FAIL
+    int resolve(const std::string& host, std::vector<in_addr>& addrs);
+
+    void clearCache();
+    //重新读取hosts文件
+    void reloadHosts();
+
+    //实际发出的查询数(不含重试)
+    uint64_t getQueryCount() const { return m_queryCount; }
+    uint64_t getCacheHits() const { return m_cacheHits; }
+    //等待其他协程查询结果的次数
+    uint64_t getCoalesced() const { return m_coalesced; }
+private:
+    struct Entry {
+        int error = 0;
+        std::vector<in_addr> addrs;
+        uint64_t expireMs = 0;
+    };
+
+    struct Pending {
+        int error = 0;
+        std::vector<in_addr> addrs;
+        std::vector<std::pair<Scheduler*, Fiber::ptr> > waiters;
+    };
+
+    void loadResolvConf();
+    std::vector<sockaddr_in> getNameservers();
+    int query(const std::string& name, std::vector<in_addr>& addrs, uint32_t& ttl);
+    int queryServer(const sockaddr_in& ns, const std::string& name, uint64_t timeout_ms,
+                    std::vector<in_addr>& addrs, uint32_t& ttl);
+    //UDP应答被截断时通过TCP重新查询
+    int queryServerTcp(const sockaddr_in& ns, const std::string& name, const std::string& packet,
+                       uint16_t id, uint64_t end_ms, std::vector<in_addr>& addrs, uint32_t& ttl);
+    void putCache(const std::string& name, int error, const std::vector<in_addr>& addrs, uint32_t ttl);
+private:
+    MutexType m_mutex;
+    std::unordered_map<std::string, std::vector<in_addr> > m_hosts;
+    std::unordered_map<std::string, Entry> m_cache;
+    std::unordered_map<std::string, std::shared_ptr<Pending> > m_pending;
+    std::vector<sockaddr_in> m_nameservers;
+    uint64_t m_timeoutMs = 5000;
+    uint32_t m_attempts = 2;
+    std::atomic<uint64_t> m_queryCount = {0};
+    std::atomic<uint64_t> m_cacheHits = {0};
+    std::atomic<uint64_t> m_coalesced = {0};
+};
+
+typedef Singleton<DnsResolver> DnsMgr;
+
+}
@@ -1,106 +1,210 @@
 #include "fd_manager.h"
 #include "hook.h"
+#include "log.h"
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 namespace server {
 
-FdCtx::FdCtx(int fd) : m_isInit(false), m_isSocket(false), 
-    m_sysNonblock(false), m_userNonblock(false), m_isClosed(false), 
-    m_fd(fd), m_recvTimeout(-1), m_sendTimeout(-1), m_iomanager(nullptr) {
+static Logger::ptr g_logger = SERVER_LOG_NAME("system");
 
-    init();
+FdCtx::FdCtx() {
 }
 
-FdCtx::~FdCtx() {
-
+void FdCtx::reset(int fd, bool known_socket) {
+    m_fd.store(fd, std::memory_order_relaxed);
+    //在途计数保留, 迟到的enter/leave仍然成对
+    m_state.fetch_and(~(CLOSED | RELEASED), std::memory_order_acq_rel);
+    m_recvTimeout.store(-1, std::memory_order_relaxed);
+    m_sendTimeout.store(-1, std::memory_order_relaxed);
+    m_iomanager.store(nullptr, std::memory_order_relaxed);
+    if(known_socket) {
+        m_flags.store(INIT | SOCKET | SYS_NONBLOCK, std::memory_order_relaxed);
+    } else {
+        m_flags.store(0, std::memory_order_relaxed);
+        init();
+    }
 }
 
 bool FdCtx::init() {
-    if(m_isInit) {
+    if(isInit()) {
         return true;
     }
-    m_recvTimeout = -1;
-    m_sendTimeout = -1;
+    m_recvTimeout.store(-1, std::memory_order_relaxed);
+    m_sendTimeout.store(-1, std::memory_order_relaxed);
 
+    //先算好全部标志再一次写入
+    uint8_t flags = 0;
+    int fd = m_fd.load(std::memory_order_relaxed);
     struct stat fd_stat;
-    if(fstat(m_fd, &fd_stat) == -1) {
-        m_isInit = false;
-        m_isSocket = false;
-    } else {
-        m_isInit = true;
-        m_isSocket = S_ISSOCK(fd_stat.st_mode);
+    if(fstat(fd, &fd_stat) != -1) {
+        flags |= INIT;
+        if(S_ISSOCK(fd_stat.st_mode)) {
+            flags |= SOCKET;
+        }
+        if(S_ISREG(fd_stat.st_mode) || S_ISBLK(fd_stat.st_mode)) {
+            flags |= REGULAR_FILE;
+        }
     }
 
-    if(m_isSocket) {
-        int flags = fcntl_f(m_fd, F_GETFL, 0);
-        if(!(flags & O_NONBLOCK)) {
-            fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
+    if(flags & SOCKET) {
+        int fl = fcntl_f(fd, F_GETFL, 0);
+        if(!(fl & O_NONBLOCK)) {
+            fcntl_f(fd, F_SETFL, fl | O_NONBLOCK);
         }
-        m_sysNonblock = true;
-    } else {
-        m_sysNonblock = false;
+        flags |= SYS_NONBLOCK;
     }
 
-    m_userNonblock = false;
-    m_isClosed = false;
-
-    return m_isInit;
+    m_flags.store(flags, std::memory_order_relaxed);
+    return flags & INIT;
 }
     
 void FdCtx::setTimeout(int type, uint64_t v) {
     if(type == SO_RCVTIMEO) {
-        m_recvTimeout = v;
+        m_recvTimeout.store(v, std::memory_order_relaxed);
     } else {
-        m_sendTimeout = v;
+        m_sendTimeout.store(v, std::memory_order_relaxed);
     }
 }
 
 uint64_t FdCtx::getTimeout(int type) {
     if(type == SO_RCVTIMEO) {
-        return m_recvTimeout;
+        return m_recvTimeout.load(std::memory_order_relaxed);
     } else {
-        return m_sendTimeout;
+        return m_sendTimeout.load(std::memory_order_relaxed);
+    }
+}
+
+bool FdCtx::enter() {
+    uint32_t state = m_state.fetch_add(INFLIGHT, std::memory_order_acq_rel);
+    if(state & CLOSED) {
+        leave();
+        return false;
     }
+    return true;
+}
+
+void FdCtx::leave() {
+    uint32_t state = m_state.fetch_sub(INFLIGHT, std::memory_order_acq_rel) - INFLIGHT;
+    if((state & (CLOSED | RELEASED)) == CLOSED && state < INFLIGHT) {
+        int rt = release();
+        if(rt) {
+            SERVER_LOG_DEBUG(g_logger) << "deferred close fd=" << m_fd << " rt=" << rt
+                << " errno=" << errno;
+        }
+    }
+}
+
+int FdCtx::release() {
+    uint32_t state = m_state.load(std::memory_order_acquire);
+    while(true) {
+        //未关闭、已由他人关闭或还有在途调用
+        if(!(state & CLOSED) || (state & RELEASED) || state >= INFLIGHT) {
+            return 0;
+        }
+        if(m_state.compare_exchange_weak(state, state | RELEASED, std::memory_order_acq_rel)) {
+            return close_f(m_fd);
+        }
+    }
+}
+
+bool FdCtx::isClosePending() const {
+    uint32_t state = m_state.load(std::memory_order_acquire);
+    return (state & (CLOSED | RELEASED)) == CLOSED;
 }
 
 FdManager::FdManager() {
-    m_datas.resize(64);
+    for(size_t i = 0; i < MAX_CHUNKS; ++i) {
+        m_chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
 }
 
-FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-    if(fd == -1) {
+FdManager::~FdManager() {
+    for(size_t i = 0; i < MAX_CHUNKS; ++i) {
+        delete m_chunks[i].load(std::memory_order_relaxed);
+    }
+}
+
+FdCtx* FdManager::slot(int fd, bool create) {
+    if(fd < 0 || (size_t)fd >= CHUNK_SIZE * MAX_CHUNKS) {
         return nullptr;
     }
-    RWMutexType::ReadLock rlock(m_mutex);
-    if((int)m_datas.size() <= fd) {
-        if(auto_create == false) {
+    std::atomic<Chunk*>& entry = m_chunks[fd >> CHUNK_BITS];
+    Chunk* chunk = entry.load(std::memory_order_acquire);
+    if(!chunk) {
+        if(!create) {
             return nullptr;
         }
-    } else {
-        if(m_datas[fd] || !auto_create) {
-            return m_datas[fd];
+        //多个线程同时分配时只有一个成功, 其余释放自己的
+        Chunk* fresh = new Chunk;
+        if(entry.compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel)) {
+            chunk = fresh;
+        } else {
+            delete fresh;
         }
     }
-    rlock.unlock();
+    return &chunk->ctxs[fd & (CHUNK_SIZE - 1)];
+}
+
+FdCtx* FdManager::get(int fd, bool auto_create) {
+    FdCtx* ctx = slot(fd, auto_create);
+    if(!ctx) {
+        return nullptr;
+    }
+    if(ctx->isUsed()) {
+        return ctx;
+    }
+    //已close的fd在关闭完成前不重建, 用户继续使用它属于错误
+    if(!auto_create || ctx->isClosePending()) {
+        return nullptr;
+    }
+    FdCtx::MutexType::Lock lock(ctx->m_mutex);
+    uint32_t gen = ctx->m_generation.load(std::memory_order_relaxed);
+    if(!(gen & 1)) {
+        ctx->reset(fd, false);
+        ctx->m_generation.store(gen + 1, std::memory_order_release);
+    }
+    return ctx;
+}
 
-    RWMutexType::WriteLock wlock(m_mutex);
-    FdCtx::ptr ctx(new FdCtx(fd));
-    if(fd >= (int)m_datas.size()) {
-        m_datas.resize(fd * 1.5);
+FdCtx* FdManager::addSocket(int fd, bool user_nonblock) {
+    FdCtx* ctx = slot(fd, true);
+    if(!ctx) {
+        return nullptr;
+    }
+    FdCtx::MutexType::Lock lock(ctx->m_mutex);
+    uint32_t gen = ctx->m_generation.load(std::memory_order_relaxed);
+    //旧的FdCtx还在(close未经过hook)时也换代, 等待旧fd的协程能发现
+    //先发布偶数代再reset, 读者重新检查代数即可发现槽位在reset期间被复用
+    if(gen & 1) {
+        ++gen;
+        ctx->m_generation.store(gen, std::memory_order_release);
     }
-    m_datas[fd] = ctx;
+    ctx->reset(fd, true);
+    ctx->setUserNonblock(user_nonblock);
+    ctx->m_generation.store(gen + 1, std::memory_order_release);
     return ctx;
 }
 
-void FdManager::del(int fd) {
-    RWMutexType::WriteLock lock(m_mutex);
-    if((int)m_datas.size() <= fd) {
-        return ;
+FdCtx* FdManager::del(int fd) {
+    FdCtx* ctx = slot(fd, false);
+    if(!ctx) {
+        return nullptr;
     }
-    m_datas[fd].reset();
+    FdCtx::MutexType::Lock lock(ctx->m_mutex);
+    uint32_t gen = ctx->m_generation.load(std::memory_order_relaxed);
+    if(!(gen & 1)) {
+        return nullptr;
+    }
+    ctx->m_state.fetch_or(FdCtx::CLOSED, std::memory_order_seq_cst);
+    ctx->m_generation.store(gen + 1, std::memory_order_release);
+    return ctx;
 }
 
+bool FdManager::isClosing(int fd) {
+    FdCtx* ctx = slot(fd, false);
+    return ctx && !ctx->isUsed() && ctx->isClosePending();
+}
 
-}
\ No newline at end of file
+}
@@ -1,61 +1,124 @@
 #pragma once
 
 #include <memory>
-#include <vector>
+#include <atomic>
 #include "thread.h"
 #include "iomanager.h"
 #include "singleton.h"
 
 namespace server {
 
-class FdCtx : public std::enable_shared_from_this<FdCtx> {
+//fd上下文, 内联存放在FdManager的分块数组中, 地址在进程内不变
+//fd关闭后槽位会被复用, 用getGeneration判断挂起期间fd是否已关闭或被复用
+class FdCtx : Noncopyable {
 public:
-    typedef std::shared_ptr<FdCtx> ptr;
+    typedef CASLock MutexType;
 
-    FdCtx(int fd);
-    ~FdCtx();
+    FdCtx();
 
     bool init();
-    bool isInit() const { return m_isInit; }
-    bool isSocket() const { return m_isSocket; }
-    bool isClose() const { return m_isClosed; }
+    bool isInit() const { return hasFlag(INIT); }
+    bool isSocket() const { return hasFlag(SOCKET); }
+    //普通文件或块设备, 不能用epoll等待, 阻塞调用交给OffloadPool
+    bool isFile() const { return hasFlag(REGULAR_FILE); }
+    bool isClose() const { return m_state.load(std::memory_order_seq_cst) & CLOSED; }
 
-    void setUserNonblock(bool v) { m_userNonblock = v; }
-    bool getUserNonblock() const { return m_userNonblock; }
+    void setUserNonblock(bool v) { setFlag(USER_NONBLOCK, v); }
+    bool getUserNonblock() const { return hasFlag(USER_NONBLOCK); }
 
-    void setSysNonblock(bool v) { m_sysNonblock = v; }
-    bool getSysNonblock() const { return m_sysNonblock; }
+    void setSysNonblock(bool v) { setFlag(SYS_NONBLOCK, v); }
+    bool getSysNonblock() const { return hasFlag(SYS_NONBLOCK); }
 
     void setTimeout(int type, uint64_t v);
     uint64_t getTimeout(int type);
 
+    //在该fd上挂起等待的IOManager, 登记等待前设置, close时在它上面cancelAll
+    //与isClose配对使用seq_cst: close要么看到这里的IOManager, 要么等待者在addEvent后看到已关闭
+    void setIOManager(IOManager* iom) { m_iomanager.store(iom, std::memory_order_seq_cst); }
+    IOManager* getIOManager() const { return m_iomanager.load(std::memory_order_seq_cst); }
+    //IOManager析构时清除仍指向它的记录
+    void clearIOManager(IOManager* iom) { m_iomanager.compare_exchange_strong(iom, nullptr); }
+
+    //奇数表示槽位在用, 每次建立或删除加1
+    uint32_t getGeneration() const { return m_generation.load(std::memory_order_acquire); }
+    bool isUsed() const { return getGeneration() & 1; }
+
+    //hook中的系统调用开始前调用, 期间close只做标记, 真正的close_f推迟到最后一个leave
+    //fd已关闭返回false, 此时不用再leave
+    bool enter();
+    void leave();
+    //close: 没有在途调用时立即close_f并返回其结果, 否则返回0, 由最后一个leave关闭
+    int release();
 private:
-    bool m_isInit : 1;
-    bool m_isSocket : 1;
-    bool m_sysNonblock : 1;
-    bool m_userNonblock : 1;
-    bool m_isClosed : 1;
-    int m_fd;
-    uint64_t m_recvTimeout;
-    uint64_t m_sendTimeout;
-    server::IOManager* m_iomanager;
-
+    friend class FdManager;
+    //known_socket: fd是以SOCK_NONBLOCK创建的socket, 不再fstat/fcntl
+    void reset(int fd, bool known_socket);
+    //已close但还有在途调用, fd尚未真正关闭
+    bool isClosePending() const;
+
+    bool hasFlag(uint8_t flag) const { return m_flags.load(std::memory_order_relaxed) & flag; }
+    void setFlag(uint8_t flag, bool v) {
+        if(v) {
+            m_flags.fetch_or(flag, std::memory_order_relaxed);
+        } else {
+            m_flags.fetch_and(~flag, std::memory_order_relaxed);
+        }
+    }
+private:
+    //m_state: 低两位为状态, 其余为在途调用数
+    static const uint32_t CLOSED = 0x1;
+    static const uint32_t RELEASED = 0x2;
+    static const uint32_t INFLIGHT = 0x4;
+
+    //m_flags的各位
+    static const uint8_t INIT = 0x1;
+    static const uint8_t SOCKET = 0x2;
+    static const uint8_t REGULAR_FILE = 0x4;
+    static const uint8_t SYS_NONBLOCK = 0x8;
+    static const uint8_t USER_NONBLOCK = 0x10;
+
+    //读不加锁, 槽位可能被并发reset, 各字段都用原子量避免读到撕裂的值
+    std::atomic<uint8_t> m_flags = {0};
+    std::atomic<int> m_fd = {-1};
+    std::atomic<uint64_t> m_recvTimeout = {(uint64_t)-1};
+    std::atomic<uint64_t> m_sendTimeout = {(uint64_t)-1};
+    std::atomic<IOManager*> m_iomanager = {nullptr};
+    std::atomic<uint32_t> m_generation = {0};
+    std::atomic<uint32_t> m_state = {0};
+    //只保护建立/删除, 读不加锁
+    MutexType m_mutex;
 };
 
+//fd -> FdCtx表, 按fd号分块, 块在第一次使用时分配且不再释放, 读取不加锁
 class FdManager {
 public:
-    typedef RWMutex RWMutexType;
-
     FdManager();
+    ~FdManager();
+
+    //fd不在表中时返回nullptr, auto_create为true时建立
+    FdCtx* get(int fd, bool auto_create = false);
+    //登记以SOCK_NONBLOCK新建的socket(socket/accept4), 覆盖旧的FdCtx
+    FdCtx* addSocket(int fd, bool user_nonblock = false);
+    //标记关闭并换代, 之后新的调用和被唤醒的等待者都会得到EBADF; fd不在表中或已关闭返回nullptr
+    //真正的关闭由调用方通过FdCtx::release完成
+    FdCtx* del(int fd);
+    //fd已close但还有在途调用, 尚未真正关闭
+    bool isClosing(int fd);
+
+    //每块的fd数与最大块数, 可管理的fd为[0, CHUNK_SIZE * MAX_CHUNKS)
+    static const size_t CHUNK_BITS = 10;
+    static const size_t CHUNK_SIZE = 1 << CHUNK_BITS;
+    static const size_t MAX_CHUNKS = 1024;
+private:
+    struct Chunk {
+        FdCtx ctxs[CHUNK_SIZE];
+    };
 
-    FdCtx::ptr get(int fd, bool auto_create = false);
-    void del(int fd);
-
+    FdCtx* slot(int fd, bool create);
 private:
-    RWMutexType m_mutex;
-    std::vector<FdCtx::ptr> m_datas;
+    std::atomic<Chunk*> m_chunks[MAX_CHUNKS];
 };
 
 typedef Singleton<FdManager> FdMgr;
 
-}
\ No newline at end of file
+}
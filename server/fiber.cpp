@@ -3,6 +3,7 @@
 #include "macro.h"
 #include "log.h"
 #include "scheduler.h"
+#include "numa.h"
 #include <atomic>
 
 namespace server {
@@ -16,18 +17,25 @@ static thread_local Fiber::ptr t_threadFiber = nullptr;         //主fiber
 static ConfigVar<u_int32_t>::ptr g_fiber_stack_size = 
     Config::Lookup<u_int32_t>("fiber.stack_size", 1024 * 1024, "fiber stack size");
 
-class MallocStackAllocator {
+//node < 0时使用malloc, 否则在对应NUMA节点上分配
+class NumaStackAllocator {
 public:
-    static void* Alloc(size_t size) {
-        return malloc(size);
+    static void* Alloc(size_t size, int node) {
+        if(node < 0) {
+            return malloc(size);
+        }
+        return NumaMgr::GetInstance()->alloc(size, node);
     }
 
-    static void Dealloc(void* vp, size_t size) {
-        return free(vp);
+    static void Dealloc(void* vp, size_t size, int node) {
+        if(node < 0) {
+            return free(vp);
+        }
+        NumaMgr::GetInstance()->dealloc(vp, size, node);
     }
 };
 
-using StackAllocator = MallocStackAllocator;
+using StackAllocator = NumaStackAllocator;
 
 Fiber::Fiber() {
     m_state = EXEC;
@@ -40,13 +48,15 @@ Fiber::Fiber() {
     SERVER_LOG_DEBUG(g_logger) << "Fiber::Fiber";
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
-    : m_id(++s_fiber_id), m_cb(cb) {
+Fiber::Fiber(Callback cb, size_t stacksize, bool use_caller)
+    : m_id(++s_fiber_id), m_cb(std::move(cb)) {
     
     ++s_fiber_count;
     m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
 
-    m_stack = StackAllocator::Alloc(m_stacksize);
+    //栈分配在创建线程所在节点上
+    m_stackNode = NumaTopology::GetCurrentNode();
+    m_stack = StackAllocator::Alloc(m_stacksize, m_stackNode);
     if(getcontext(&m_ctx)) {
         SERVER_ASSERT2(false, "getcontext");
     }
@@ -68,7 +78,7 @@ Fiber::~Fiber() {
     --s_fiber_count;
     if(m_stack) {
         SERVER_ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEPT);
-        StackAllocator::Dealloc(m_stack, m_stacksize);
+        StackAllocator::Dealloc(m_stack, m_stacksize, m_stackNode);
     }
     else {
         SERVER_ASSERT(!m_cb);
@@ -83,10 +93,10 @@ Fiber::~Fiber() {
 }
 
 //重置协程函数，并重置状态  INIT, TERM
-void Fiber::reset(std::function<void()> cb) {
+void Fiber::reset(Callback cb) {
     SERVER_ASSERT(m_stack);
     SERVER_ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEPT);
-    m_cb = cb;
+    m_cb = std::move(cb);
     if(getcontext(&m_ctx)) {
         SERVER_ASSERT2(false, "getcontext");
     }
@@ -96,6 +106,10 @@ void Fiber::reset(std::function<void()> cb) {
 
     makecontext(&m_ctx, &Fiber::MainFunc, 0);
     m_state = INIT;
+    m_priority = NORMAL;
+    m_deadline = 0;
+    m_cancelled = false;
+    clearCancelHandler();
 }
 
 //切换到当前协程执行
@@ -131,6 +145,41 @@ void Fiber::back() {
     }
 }
 
+void Fiber::cancel() {
+    Callback cb;
+    {
+        Spinlock::Lock lock(m_cancelMutex);
+        if(m_cancelled) {
+            return;
+        }
+        m_cancelled = true;
+        cb.swap(m_cancelCb);
+    }
+    if(cb) {
+        cb();
+    }
+}
+
+void Fiber::setCancelHandler(Callback cb) {
+    {
+        Spinlock::Lock lock(m_cancelMutex);
+        if(!m_cancelled) {
+            m_cancelCb.swap(cb);
+            return;
+        }
+    }
+    //已取消, cancel()执行时还没有处理函数
+    if(cb) {
+        cb();
+    }
+}
+
+void Fiber::clearCancelHandler() {
+    Callback cb;
+    Spinlock::Lock lock(m_cancelMutex);
+    cb.swap(m_cancelCb);
+}
+
 //返回当前协程
 Fiber::ptr Fiber::GetThis() {
     if(t_fiber) {
@@ -142,6 +191,13 @@ Fiber::ptr Fiber::GetThis() {
     return t_fiber->shared_from_this();
 }
 
+Fiber* Fiber::GetThisRaw() {
+    if(t_fiber) {
+        return t_fiber;
+    }
+    return GetThis().get();
+}
+
 //设置当前协程
 void Fiber::SetThis(Fiber* f) {
     t_fiber = f;
@@ -149,18 +205,34 @@ void Fiber::SetThis(Fiber* f) {
 
 //协程切换到后台，设置为Ready状态
 void Fiber::YieldToReady() {
-    Fiber::ptr cur = GetThis();
+    Fiber* cur = GetThisRaw();
     cur->m_state = READY;
     cur->swapOut();
 }
 
 //协程切换到后台，设置为Hold状态
 void Fiber::YieldToHold() {
-    Fiber::ptr cur = GetThis();
+    Fiber* cur = GetThisRaw();
     cur->m_state = HOLD;
     cur->swapOut();
 }
 
+void Fiber::MaybeYield() {
+    if(!Scheduler::IsOverBudget()) {
+        return;
+    }
+    Fiber* cur = t_fiber;
+    if(!cur || !cur->m_stack || cur == Scheduler::GetMainFiber()) {
+        return;
+    }
+    //超时已由watchdog线程报告; 它没能取到栈时由协程在这里记录自己的, 每次报告最多一次
+    if(Scheduler::TakeStackRequest()) {
+        SERVER_LOG_WARN(g_logger) << "watchdog: fiber_id=" << cur->getId()
+            << " yielding at checkpoint, stack:" << std::endl << BacktraceToString(64, 2, "    ");
+    }
+    YieldToReady();
+}
+
 uint64_t Fiber::GetFiberId() {
     if(t_fiber) {
         return t_fiber->getId();
@@ -174,7 +246,8 @@ uint64_t Fiber::TotalFibers() {
 }
 
 void Fiber::MainFunc() {
-    Fiber::ptr cur = GetThis();
+    //调用方(调度器或swapIn的持有者)保证协程存活，这里不再持有引用
+    Fiber* cur = GetThisRaw();
     SERVER_ASSERT(cur);
     try {
         cur->m_cb();
@@ -194,14 +267,13 @@ void Fiber::MainFunc() {
             << server::BacktraceToString();
     }
 
-    auto raw_ptr = cur.get();
-    cur.reset();
-    raw_ptr->swapOut();
-    SERVER_ASSERT2(false, "never reach fiber_id=" + std::to_string(raw_ptr->getId()));
+    cur->swapOut();
+    SERVER_ASSERT2(false, "never reach fiber_id=" + std::to_string(cur->getId()));
 }   
 
 void Fiber::CallerMainFunc() {
-    Fiber::ptr cur = GetThis();
+    //调用方(调度器或swapIn的持有者)保证协程存活，这里不再持有引用
+    Fiber* cur = GetThisRaw();
     SERVER_ASSERT(cur);
     try {
         cur->m_cb();
@@ -221,10 +293,8 @@ void Fiber::CallerMainFunc() {
             << server::BacktraceToString();
     }
 
-    auto raw_ptr = cur.get();
-    cur.reset();
-    raw_ptr->back();
-    SERVER_ASSERT2(false, "never reach fiber_id=" + std::to_string(raw_ptr->getId()));
+    cur->back();
+    SERVER_ASSERT2(false, "never reach fiber_id=" + std::to_string(cur->getId()));
 }
 
 }
\ No newline at end of file
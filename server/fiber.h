@@ -4,6 +4,7 @@
 #include <memory>
 #include <functional>
 #include "thread.h"
+#include "callback.h"
 
 namespace server {
 
@@ -21,14 +22,22 @@ public:
         READY,
         EXCEPT
     };
+
+    //调度优先级, 数值越小越先执行
+    enum Priority {
+        HIGH = 0,
+        NORMAL = 1,
+        LOW = 2,
+        PRIORITY_NUM = 3
+    };
 private:
     Fiber();
 public:
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+    Fiber(Callback cb, size_t stacksize = 0, bool use_caller = false);
     ~Fiber();
 
     //重置协程函数，并重置状态  INIT, TERM
-    void reset(std::function<void()> cb);
+    void reset(Callback cb);
     //切换到当前协程执行
     void swapIn();
     //切换到后台执行
@@ -37,17 +46,40 @@ public:
     void call();
     void back();
 
+    //取消协程: 设置取消标记并唤醒阻塞在hook调用(IO/connect/sleep)上的协程, 该调用返回ECANCELED
+    //可在任意线程调用, 协程之后的阻塞hook调用也会直接返回ECANCELED
+    void cancel();
+    bool isCancelled() const { return m_cancelled; }
+    //截止时间(绝对时间, GetCurrentMS), 0表示不限制; hook的IO、connect、sleep等待不会超过截止时间
+    uint64_t getDeadline() const { return m_deadline; }
+    void setDeadline(uint64_t v) { m_deadline = v; }
+
+    //hook挂起前设置的唤醒函数, 协程已被取消时立即执行而不保存
+    void setCancelHandler(Callback cb);
+    void clearCancelHandler();
+
     uint64_t getId() { return m_id; }
+    uint32_t getStackSize() const { return m_stacksize; }
+    void* getStack() const { return m_stack; }
+    //栈所在NUMA节点, 未绑定节点时为-1
+    int getStackNode() const { return m_stackNode; }
     State getState() const { return m_state; }
+    //协程被唤醒(事件、定时器、YieldToReady)后重新调度时使用的优先级
+    Priority getPriority() const { return m_priority; }
+    void setPriority(Priority v) { m_priority = v; }
 
     //返回当前协程
     static Fiber::ptr GetThis();
+    //返回当前协程的裸指针，不增加引用计数，用于调度器内部的切换路径
+    static Fiber* GetThisRaw();
     //设置当前协程
     static void SetThis(Fiber* f);
     //协程切换到后台，设置为Ready状态
     static void YieldToReady();
     //协程切换到后台，设置为Hold状态
     static void YieldToHold();
+    //协作式抢占检查点: 当前协程运行超过watchdog预算时让出执行权, 否则立即返回
+    static void MaybeYield();
     static uint64_t GetFiberId();
 
     //总协程数
@@ -59,10 +91,16 @@ public:
 private:
     uint64_t m_id = 0;
     uint32_t m_stacksize = 0;
+    int m_stackNode = -1;
     State m_state = INIT;
+    Priority m_priority = NORMAL;
+    uint64_t m_deadline = 0;
     ucontext_t m_ctx;
     void* m_stack = nullptr;
-    std::function<void()> m_cb;
+    Callback m_cb;
+    std::atomic<bool> m_cancelled = {false};
+    Spinlock m_cancelMutex;
+    Callback m_cancelCb;        //取消时执行, 撤销挂起的IO事件或定时器
 };
 
 }
\ No newline at end of file
@@ -2,12 +2,14 @@
 #include "fiber.h"
 #include "iomanager.h"
 #include "fd_manager.h"
+#include "offload.h"
 #include "log.h"
 #include "config.h"
 
 #include <iostream>
 #include <dlfcn.h>
 #include <sys/uio.h>
+#include <vector>
 
 server::Logger::ptr g_logger = SERVER_LOG_NAME("system");
 
@@ -15,6 +17,8 @@ namespace server {
 
 static server::ConfigVar<int>::ptr g_tcp_connect_timeout = 
     server::Config::Lookup<int>("tcp.connect.timeout", (int)5000, "tcp connect timeout");
+static server::ConfigVar<bool>::ptr g_offload_file_io = 
+    server::Config::Lookup<bool>("hook.offload_file_io", true, "run blocking io on regular files in the offload pool");
 static thread_local bool t_hook_enable = false;
 
 #define HOOK_FUN(XX) \
@@ -24,6 +28,7 @@ static thread_local bool t_hook_enable = false;
     XX(socket) \
     XX(connect) \
     XX(accept) \
+    XX(accept4) \
     XX(close) \
     XX(fcntl) \
     XX(ioctl) \
@@ -34,11 +39,18 @@ static thread_local bool t_hook_enable = false;
     XX(recv) \
     XX(recvfrom) \
     XX(recvmsg) \
+    XX(recvmmsg) \
     XX(write) \
     XX(writev) \
     XX(send) \
     XX(sendto) \
-    XX(sendmsg)
+    XX(sendmsg) \
+    XX(sendmmsg) \
+    XX(sendfile) \
+    XX(splice) \
+    XX(poll) \
+    XX(select) \
+    XX(epoll_wait)
 
 
 void hook_init() {
@@ -53,10 +65,16 @@ void hook_init() {
 }
 
 static uint64_t s_connect_timeout = -1;
+static bool s_offload_file_io = true;
 struct _HookIniter {
     _HookIniter() {
         hook_init();
         s_connect_timeout = g_tcp_connect_timeout->getValue();
+        s_offload_file_io = g_offload_file_io->getValue();
+
+        g_offload_file_io->addListener([](const bool& old_value, const bool& new_value) {
+            s_offload_file_io = new_value;
+        });
 
         g_tcp_connect_timeout->addListener([](const uint64_t& old_value, const uint64_t& new_value) {
             SERVER_LOG_INFO(g_logger) << "tcp connect timeout changed, old_value="
@@ -78,40 +96,318 @@ void set_hook_enable(bool flag) {
 
 }
 
+//等待结束的原因, 由超时定时器和取消处理函数在各自线程中设置, 先到者生效
 struct timer_info {
-    int cancelled = 0;
+    std::atomic<int> cancelled = {0};
+
+    bool cancel(int err) {
+        int expected = 0;
+        return cancelled.compare_exchange_strong(expected, err);
+    }
 };
 
+//结合协程截止时间计算等待时间, (uint64_t)-1表示不超时; 截止时间已过返回false
+static bool deadline_timeout(server::Fiber* fiber, uint64_t& timeout_ms) {
+    uint64_t deadline = fiber->getDeadline();
+    if(!deadline) {
+        return true;
+    }
+    uint64_t now_ms = server::GetCurrentMS();
+    if(now_ms >= deadline) {
+        return false;
+    }
+    if(deadline - now_ms < timeout_ms) {
+        timeout_ms = deadline - now_ms;
+    }
+    return true;
+}
+
+//sleep类hook: 挂起当前协程ms毫秒, 不超过协程截止时间
+//正常返回0, 被Fiber::cancel唤醒返回ECANCELED, 截止时间先到返回ETIMEDOUT, remain_ms为剩余时间
+static int do_sleep(uint64_t ms, uint64_t* remain_ms = nullptr) {
+    server::Fiber::ptr fiber = server::Fiber::GetThis();
+    uint64_t end_ms = server::GetCurrentMS() + ms;
+    uint64_t wait_ms = ms;
+    bool in_time = deadline_timeout(fiber.get(), wait_ms);
+    if(fiber->isCancelled() || !in_time) {
+        if(remain_ms) {
+            *remain_ms = ms;
+        }
+        return fiber->isCancelled() ? ECANCELED : ETIMEDOUT;
+    }
+    server::IOManager* iom = server::IOManager::GetThis();
+    //定时器和取消都可能唤醒协程, 只允许调度一次
+    std::shared_ptr<std::atomic<bool>> woken(new std::atomic<bool>(false));
+    auto wake = [iom, fiber, woken]() {
+        if(!woken->exchange(true)) {
+            iom->schedule(fiber);
+        }
+    };
+    server::Timer::ptr timer = iom->addTimer(wait_ms, wake);
+    fiber->setCancelHandler([timer, wake]() {
+        timer->cancel();
+        wake();
+    });
+    server::Fiber::YieldToHold();
+    fiber->clearCancelHandler();
+    if(fiber->isCancelled() || wait_ms < ms) {
+        if(remain_ms) {
+            uint64_t now_ms = server::GetCurrentMS();
+            *remain_ms = end_ms > now_ms ? end_ms - now_ms : 0;
+        }
+        return fiber->isCancelled() ? ECANCELED : ETIMEDOUT;
+    }
+    return 0;
+}
+
+//poll/select/epoll_wait的公共实现: 先非阻塞poll一次, 未就绪时把fd作为等待者注册到IOManager并挂起协程
+//同一fd事件上的多个等待者(以及do_io的协程)共用一个epoll注册, 触发时全部唤醒
+//返回值同poll; 被Fiber::cancel唤醒返回-1/ECANCELED, 协程截止时间先到返回-1/ETIMEDOUT
+static int do_poll(struct pollfd* fds, nfds_t nfds, int timeout) {
+    server::IOManager* iom = server::IOManager::GetThis();
+    if(!iom) {
+        return poll_f(fds, nfds, timeout);
+    }
+    int rt = poll_f(fds, nfds, 0);
+    if(rt != 0 || timeout == 0) {
+        return rt;
+    }
+
+    //同一fd可能在数组中出现多次, 合并后再注册
+    std::vector<std::pair<int, uint32_t> > interests;
+    for(nfds_t i = 0; i < nfds; ++i) {
+        if(fds[i].fd < 0) {
+            continue;
+        }
+        uint32_t event = server::IOManager::NONE;
+        if(fds[i].events & (POLLIN | POLLPRI | POLLRDHUP)) {
+            event |= server::IOManager::READ;
+        }
+        if(fds[i].events & POLLOUT) {
+            event |= server::IOManager::WRITE;
+        }
+        if(!event) {
+            continue;
+        }
+        bool merged = false;
+        for(auto& it : interests) {
+            if(it.first == fds[i].fd) {
+                it.second |= event;
+                merged = true;
+                break;
+            }
+        }
+        if(!merged) {
+            interests.push_back(std::make_pair(fds[i].fd, event));
+        }
+    }
+
+    struct Registered {
+        int fd;
+        server::IOManager::Event event;
+        uint64_t id;
+    };
+    server::Fiber::ptr fiber = server::Fiber::GetThis();
+    uint64_t end_ms = timeout < 0 ? (uint64_t)-1 : server::GetCurrentMS() + timeout;
+    std::vector<Registered> registered;
+    while(true) {
+        if(fiber->isCancelled()) {
+            errno = ECANCELED;
+            return -1;
+        }
+        uint64_t wait_ms = (uint64_t)-1;
+        if(end_ms != (uint64_t)-1) {
+            uint64_t now_ms = server::GetCurrentMS();
+            if(now_ms >= end_ms) {
+                return 0;
+            }
+            wait_ms = end_ms - now_ms;
+        }
+        if(!deadline_timeout(fiber.get(), wait_ms)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+
+        //多个fd、定时器和取消都可能唤醒协程, 只允许调度一次
+        std::shared_ptr<std::atomic<bool>> woken(new std::atomic<bool>(false));
+        auto wake = [iom, fiber, woken]() {
+            if(!woken->exchange(true)) {
+                iom->schedule(fiber);
+            }
+        };
+        registered.clear();
+        int err = 0;
+        for(auto& it : interests) {
+            for(uint32_t e : {server::IOManager::READ, server::IOManager::WRITE}) {
+                if(!(it.second & e)) {
+                    continue;
+                }
+                Registered r = {it.first, (server::IOManager::Event)e, 0};
+                server::FdCtx* ctx = server::FdMgr::GetInstance()->get(r.fd);
+                if(ctx) {
+                    ctx->setIOManager(iom);
+                }
+                if(iom->addWaiter(r.fd, r.event, wake, r.id)) {
+                    err = errno;
+                    break;
+                }
+                registered.push_back(r);
+            }
+            if(err) {
+                break;
+            }
+        }
+        server::Timer::ptr timer;
+        if(!err) {
+            if(wait_ms != (uint64_t)-1) {
+                timer = iom->addTimer(wait_ms, wake);
+            }
+            fiber->setCancelHandler([timer, wake]() {
+                if(timer) {
+                    timer->cancel();
+                }
+                wake();
+            });
+            server::Fiber::YieldToHold();
+            fiber->clearCancelHandler();
+            if(timer) {
+                timer->cancel();
+            }
+        }
+        //只删除自己的等待者: 已触发的不在列表中, 其他协程的注册不受影响
+        for(auto& it : registered) {
+            iom->delWaiter(it.fd, it.event, it.id);
+        }
+        if(err) {
+            errno = err;
+            return -1;
+        }
+
+        rt = poll_f(fds, nfds, 0);
+        if(rt != 0) {
+            return rt;
+        }
+    }
+}
+
+//fd已close但还有在途调用时不在表中, 也尚未真正关闭, 新的调用不能落到原函数上
+static bool fd_closing(int fd) {
+    if(server::FdMgr::GetInstance()->isClosing(fd)) {
+        errno = EBADF;
+        return true;
+    }
+    return false;
+}
+
+//系统调用期间持有fd: 期间其他线程close只做标记, fd号在调用结束前不会被复用
+//挂起等待前leave, 被唤醒后重新enter, fd已关闭或已换代时enter失败
+class FdInflight {
+public:
+    FdInflight(server::FdCtx* ctx)
+        : m_ctx(ctx)
+        , m_gen(ctx->getGeneration()) {
+    }
+    ~FdInflight() {
+        if(m_entered) {
+            m_ctx->leave();
+        }
+    }
+
+    bool enter() {
+        if(!m_ctx->enter()) {
+            return false;
+        }
+        m_entered = true;
+        if(m_ctx->getGeneration() != m_gen) {
+            leave();
+            return false;
+        }
+        return true;
+    }
+
+    void leave() {
+        m_entered = false;
+        m_ctx->leave();
+    }
+private:
+    server::FdCtx* m_ctx;
+    uint32_t m_gen;
+    bool m_entered = false;
+};
+
+//end_ms为调用方显式给出的截止时间(ms), 0表示没有; 等待时间取它、socket超时和协程截止时间中最早的
 template<typename OriginFun, typename ... Args>
-static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, uint32_t event, int timeout_so, Args&&... args) {
+static ssize_t do_io_until(int fd, OriginFun fun, const char* hook_fun_name, uint32_t event, int timeout_so, uint64_t end_ms, Args&&... args) {
     if(!server::t_hook_enable) {
+        if(fd_closing(fd)) {
+            return -1;
+        }
         return fun(fd, std::forward<Args>(args)...);
     }
     
-    server::FdCtx::ptr ctx = server::FdMgr::GetInstance()->get(fd);
-    if(!ctx) {
+    //open等未hook的调用返回的fd在第一次使用时建立FdCtx, 以识别普通文件
+    server::FdCtx* ctx = server::FdMgr::GetInstance()->get(fd, true);
+    if(!ctx || !ctx->isInit()) {
+        if(!ctx && fd_closing(fd)) {
+            return -1;
+        }
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    if(ctx->isClose()) {
+    FdInflight inflight(ctx);
+    if(!inflight.enter()) {
         errno = EBADF;
         return -1;
     }
 
+    if(ctx->isFile() && server::s_offload_file_io) {
+        //普通文件总是"就绪", 但可能阻塞在磁盘上, 交给线程池执行
+        ssize_t n = -1;
+        int err = 0;
+        auto call = [&]() {
+            n = fun(fd, std::forward<Args>(args)...);
+            err = errno;
+        };
+        server::OffloadMgr::GetInstance()->offload(std::ref(call));
+        errno = err;
+        return n;
+    }
+
     if(!ctx->isSocket() || ctx->getUserNonblock()) {
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    uint64_t to = ctx->getTimeout(timeout_so);
-    std::shared_ptr<timer_info> tinfo(new timer_info);
+    //数据就绪时直接返回, timer_info只在需要挂起时分配
+    std::shared_ptr<timer_info> tinfo;
 
 retry:
     ssize_t n = fun(fd, std::forward<Args>(args)...);
     while(n == -1 && errno == EINTR) {
         n = fun(fd, std::forward<Args>(args)...);
     }
-    SERVER_LOG_INFO(g_logger) << "do_io<" << hook_fun_name << " >";
     if(n == -1 && errno == EAGAIN) {
+        server::Fiber* fiber = server::Fiber::GetThisRaw();
+        if(fiber->isCancelled()) {
+            errno = ECANCELED;
+            return -1;
+        }
+        uint64_t to = ctx->getTimeout(timeout_so);
+        if(end_ms) {
+            uint64_t now_ms = server::GetCurrentMS();
+            if(now_ms >= end_ms) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            to = std::min(to, end_ms - now_ms);
+        }
+        if(!deadline_timeout(fiber, to)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if(!tinfo) {
+            tinfo.reset(new timer_info);
+        }
+        SERVER_LOG_DEBUG(g_logger) << "do_io<" << hook_fun_name << "> wait fd=" << fd;
         server::IOManager* iom = server::IOManager::GetThis();
         server::Timer::ptr timer;
         std::weak_ptr<timer_info> winfo(tinfo);
@@ -119,14 +415,14 @@ retry:
         if(to != (uint64_t)-1) {
             timer = iom->addConditionTimer(to, [winfo, fd, iom, event]() {
                 auto t = winfo.lock();
-                if(!t || t->cancelled) {
+                if(!t || !t->cancel(ETIMEDOUT)) {
                     return ;
                 }
-                t->cancelled = ETIMEDOUT;
                 iom->cancelEvent(fd, (server::IOManager::Event)(event));
             }, winfo);
         }
 
+        ctx->setIOManager(iom);
         int rt = iom->addEvent(fd, (server::IOManager::Event)(event));
         if(rt) {
             SERVER_LOG_ERROR(g_logger) << hook_fun_name << "addEvent(" << fd
@@ -136,12 +432,31 @@ retry:
             }
             return -1;
         } else {
+            fiber->setCancelHandler([winfo, fd, iom, event]() {
+                auto t = winfo.lock();
+                if(!t || !t->cancel(ECANCELED)) {
+                    return ;
+                }
+                iom->cancelEvent(fd, (server::IOManager::Event)(event));
+            });
+            //close的cancelAll早于addEvent时不会再唤醒这里, 自己取消; fd在途期间不会真正关闭
+            if(ctx->isClose()) {
+                iom->cancelEvent(fd, (server::IOManager::Event)(event));
+            }
+            inflight.leave();
             server::Fiber::YieldToHold();
+            fiber->clearCancelHandler();
             if(timer) {
                 timer->cancel();
             }
-            if(tinfo->cancelled) {
-                errno = tinfo->cancelled;
+            //挂起期间fd被关闭(可能已被复用), 不能再对它重试
+            if(!inflight.enter()) {
+                errno = EBADF;
+                return -1;
+            }
+            int err = tinfo->cancelled.load();
+            if(err) {
+                errno = err;
                 return -1;
             }
             goto retry;
@@ -150,46 +465,82 @@ retry:
     return n;
 }
 
+template<typename OriginFun, typename ... Args>
+static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, uint32_t event, int timeout_so, Args&&... args) {
+    return do_io_until(fd, fun, hook_fun_name, event, timeout_so, 0, std::forward<Args>(args)...);
+}
+
 extern "C" {
 
 #define XX(name) name ## _fun name ## _f = nullptr;
     HOOK_FUN(XX);
 #undef XX
 
+//未hook的睡眠: 被watchdog的取栈信号打断时按剩余时间继续, 其他信号仍返回EINTR
+static int raw_nanosleep(const struct timespec* req, struct timespec* rem) {
+    struct timespec left = *req;
+    while(true) {
+        uint64_t signals = server::Scheduler::GetWatchdogSignals();
+        int rt = nanosleep_f(&left, &left);
+        if(rt == 0 || errno != EINTR || server::Scheduler::GetWatchdogSignals() == signals) {
+            if(rt && rem) {
+                *rem = left;
+            }
+            return rt;
+        }
+    }
+}
+
 unsigned int sleep(unsigned int seconds) {
-    if(!server::t_hook_enable) {
-        return sleep_f(seconds);
+    //普通Scheduler的线程也开启了hook, 但没有定时器可用
+    if(!server::t_hook_enable || !server::IOManager::GetThis()) {
+        struct timespec req = {(time_t)seconds, 0};
+        struct timespec rem = {0, 0};
+        if(raw_nanosleep(&req, &rem)) {
+            return rem.tv_sec + (rem.tv_nsec ? 1 : 0);
+        }
+        return 0;
     }
 
-    server::Fiber::ptr fiber = server::Fiber::GetThis();
-    server::IOManager* iom = server::IOManager::GetThis();
-    iom->addTimer(seconds * 1000, std::bind((void(server::Scheduler::*)(server::Fiber::ptr, int thread))&server::IOManager::schedule, iom, fiber, -1));
-    server::Fiber::YieldToHold();
+    uint64_t remain_ms = 0;
+    int rt = do_sleep(seconds * 1000ull, &remain_ms);
+    if(rt) {
+        errno = rt;
+        return (remain_ms + 999) / 1000;
+    }
     return 0;
 }
 
 int usleep(useconds_t usec) {
-    if(!server::t_hook_enable) {
-        return usleep_f(usec);
+    if(!server::t_hook_enable || !server::IOManager::GetThis()) {
+        struct timespec req = {(time_t)(usec / 1000000), (long)(usec % 1000000) * 1000};
+        return raw_nanosleep(&req, nullptr);
     }
 
-    server::Fiber::ptr fiber = server::Fiber::GetThis();
-    server::IOManager* iom = server::IOManager::GetThis();
-    iom->addTimer(usec / 1000, std::bind((void(server::Scheduler::*)(server::Fiber::ptr, int thread))&server::IOManager::schedule, iom, fiber, -1));
-    server::Fiber::YieldToHold();
+    int rt = do_sleep(usec / 1000);
+    if(rt) {
+        errno = rt;
+        return -1;
+    }
     return 0;
 }
 
 int nanosleep(const struct timespec *req, struct timespec *rem) {
-    if(!server::t_hook_enable) {
-        return nanosleep_f(req, rem);
+    if(!server::t_hook_enable || !server::IOManager::GetThis()) {
+        return raw_nanosleep(req, rem);
     }
 
-    server::Fiber::ptr fiber = server::Fiber::GetThis();
-    server::IOManager* iom = server::IOManager::GetThis();
-    int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
-    iom->addTimer(timeout_ms, std::bind((void(server::Scheduler::*)(server::Fiber::ptr, int thread))&server::IOManager::schedule, iom, fiber, -1));
-    server::Fiber::YieldToHold();
+    uint64_t timeout_ms = req->tv_sec * 1000ull + req->tv_nsec / 1000 / 1000;
+    uint64_t remain_ms = 0;
+    int rt = do_sleep(timeout_ms, &remain_ms);
+    if(rt) {
+        if(rem) {
+            rem->tv_sec = remain_ms / 1000;
+            rem->tv_nsec = remain_ms % 1000 * 1000 * 1000;
+        }
+        errno = rt;
+        return -1;
+    }
     return 0;
 }
 
@@ -198,20 +549,24 @@ int socket(int domain, int type, int protocol) {
         return socket_f(domain, type, protocol);
     }
 
-    int fd = socket_f(domain, type, protocol);
+    //直接创建非阻塞socket, 省去FdCtx初始化时的fstat和两次fcntl
+    int fd = socket_f(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
     if(fd == -1) {
         return fd;
     }
-    server::FdMgr::GetInstance()->get(fd, true);
+    server::FdMgr::GetInstance()->addSocket(fd, type & SOCK_NONBLOCK);
     return fd;
 }
 
 int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addrlen, uint64_t timeout_ms) {
+    if(fd_closing(sockfd)) {
+        return -1;
+    }
     if(!server::t_hook_enable) {
         return connect_f(sockfd, addr, addrlen);
     }
 
-    server::FdCtx::ptr ctx = server::FdMgr::GetInstance()->get(sockfd);
+    server::FdCtx* ctx = server::FdMgr::GetInstance()->get(sockfd);
     if(!ctx || ctx->isClose()) {
         errno = EBADF;
         return -1;
@@ -225,6 +580,11 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
         return connect_f(sockfd, addr, addrlen);
     }
 
+    FdInflight inflight(ctx);
+    if(!inflight.enter()) {
+        errno = EBADF;
+        return -1;
+    }
     int n = connect_f(sockfd, addr, addrlen);
     if(n == 0) {
         return n;
@@ -232,6 +592,15 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
         return n;
     }
 
+    server::Fiber* fiber = server::Fiber::GetThisRaw();
+    if(fiber->isCancelled()) {
+        errno = ECANCELED;
+        return -1;
+    }
+    if(!deadline_timeout(fiber, timeout_ms)) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
     server::IOManager* iom = server::IOManager::GetThis();
     server::Timer::ptr timer;
     std::shared_ptr<timer_info> tinfo(new timer_info);
@@ -240,21 +609,38 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
     if(timeout_ms != (uint64_t)-1) {
         timer = iom->addConditionTimer(timeout_ms, [winfo, sockfd, iom]() {
             auto t = winfo.lock();
-            if(!t || t->cancelled) {
+            if(!t || !t->cancel(ETIMEDOUT)) {
                 return ;
             }
-            t->cancelled = ETIMEDOUT;
             iom->cancelEvent(sockfd, server::IOManager::WRITE);
         }, winfo);
     }
+    ctx->setIOManager(iom);
     int rt = iom->addEvent(sockfd, server::IOManager::WRITE);
     if(rt == 0) {
+        fiber->setCancelHandler([winfo, sockfd, iom]() {
+            auto t = winfo.lock();
+            if(!t || !t->cancel(ECANCELED)) {
+                return ;
+            }
+            iom->cancelEvent(sockfd, server::IOManager::WRITE);
+        });
+        if(ctx->isClose()) {
+            iom->cancelEvent(sockfd, server::IOManager::WRITE);
+        }
+        inflight.leave();
         server::Fiber::YieldToHold();
+        fiber->clearCancelHandler();
         if(timer) {
             timer->cancel();
         }
-        if(tinfo->cancelled) {
-            errno = tinfo->cancelled;
+        if(!inflight.enter()) {
+            errno = EBADF;
+            return -1;
+        }
+        int err = tinfo->cancelled.load();
+        if(err) {
+            errno = err;
             return -1;
         }
     } else {
@@ -282,30 +668,48 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 }
 
 int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
-    int fd = do_io(sockfd, accept_f, "accept", server::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    if(!server::t_hook_enable) {
+        return accept_f(sockfd, addr, addrlen);
+    }
+    return accept4(sockfd, addr, addrlen, 0);
+}
+
+int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+    if(!server::t_hook_enable) {
+        return accept4_f(sockfd, addr, addrlen, flags);
+    }
+    int fd = do_io(sockfd, accept4_f, "accept4", server::IOManager::READ, SO_RCVTIMEO,
+                addr, addrlen, flags | SOCK_NONBLOCK | SOCK_CLOEXEC);
     if(fd >= 0) {
-        server::FdMgr::GetInstance()->get(fd, true);
+        server::FdMgr::GetInstance()->addSocket(fd, flags & SOCK_NONBLOCK);
     }
     return fd;
 }
 
 int close(int fd) {
-    if(!server::t_hook_enable) {
+    //标记关闭并换代: 之后新的调用和被唤醒的等待者都得到EBADF
+    server::FdCtx* ctx = server::FdMgr::GetInstance()->del(fd);
+    if(!ctx) {
+        //重复close, fd还没有真正关闭, 不能提前关掉
+        if(server::FdMgr::GetInstance()->isClosing(fd)) {
+            errno = EBADF;
+            return -1;
+        }
         return close_f(fd);
     }
-
-    server::FdCtx::ptr ctx = server::FdMgr::GetInstance()->get(fd);
-    if(ctx) {
-        auto iom = server::IOManager::GetThis();
-        if(iom) {
-            iom->cancelAll(fd);
-        }
-        server::FdMgr::GetInstance()->del(fd);
+    //唤醒在该fd上挂起的协程, 与当前线程是否开启hook、属于哪个IOManager无关
+    server::IOManager* iom = ctx->getIOManager();
+    if(iom) {
+        iom->cancelAll(fd);
     }
-    return close_f(fd);
+    //其他线程还在该fd的系统调用中时推迟close_f, 避免fd号被复用后它们操作到新连接上
+    return ctx->release();
 }
 
 int fcntl(int fd, int cmd, ...) {
+    if(fd_closing(fd)) {
+        return -1;
+    }
     va_list va;
     va_start(va, cmd);
     switch(cmd) {
@@ -313,7 +717,7 @@ int fcntl(int fd, int cmd, ...) {
             {
                 int arg = va_arg(va, int);
                 va_end(va);
-                server::FdCtx::ptr ctx = server::FdMgr::GetInstance()->get(fd);
+                server::FdCtx* ctx = server::FdMgr::GetInstance()->get(fd);
                 if(!ctx || ctx->isClose() || !ctx->isSocket()) {
                     return fcntl_f(fd, cmd, arg);
                 }
@@ -330,7 +734,7 @@ int fcntl(int fd, int cmd, ...) {
             {
                 va_end(va);
                 int arg = fcntl_f(fd, cmd);
-                server::FdCtx::ptr ctx = server::FdMgr::GetInstance()->get(fd);
+                server::FdCtx* ctx = server::FdMgr::GetInstance()->get(fd);
                 if(!ctx || ctx->isClose() || !ctx->isSocket()) {
                     return arg;
                 }
@@ -395,9 +799,12 @@ int ioctl(int fd, unsigned long int request, ...) {
     void* arg = va_arg(va, void*);
     va_end(va);
 
+    if(fd_closing(fd)) {
+        return -1;
+    }
     if(FIONBIO == request) {
         bool user_nonblock = !!*(int*)arg;
-        server::FdCtx::ptr ctx = server::FdMgr::GetInstance()->get(fd);
+        server::FdCtx* ctx = server::FdMgr::GetInstance()->get(fd);
         if(!ctx || ctx->isClose() || !ctx->isSocket()) {
             return ioctl_f(fd, request, arg);
         }
@@ -407,17 +814,23 @@ int ioctl(int fd, unsigned long int request, ...) {
 }
 
 int getsockopt(int sockfd, int level, int optname, void *optval, socklen_t *optlen) {
+    if(fd_closing(sockfd)) {
+        return -1;
+    }
     return getsockopt_f(sockfd, level, optname, optval, optlen);
 }
 
 int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen) {
+    if(fd_closing(sockfd)) {
+        return -1;
+    }
     if(!server::t_hook_enable) {
         return setsockopt_f(sockfd, level, optname, optval, optlen);
     }
 
     if(level == SOL_SOCKET) {
         if(optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
-            server::FdCtx::ptr ctx = server::FdMgr::GetInstance()->get(sockfd);
+            server::FdCtx* ctx = server::FdMgr::GetInstance()->get(sockfd);
             if(ctx) {
                 const timeval* v = (const timeval*)optval;
                 ctx->setTimeout(optname, v->tv_sec * 1000 + v->tv_usec / 1000);
@@ -447,6 +860,24 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
     return do_io(sockfd, recvmsg_f, "recvmsg", server::IOManager::READ, SO_RCVTIMEO, msg, flags);
 }
 
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout) {
+    if(!server::t_hook_enable || !timeout) {
+        return do_io(sockfd, recvmmsg_f, "recvmmsg", server::IOManager::READ, SO_RCVTIMEO, msgvec, vlen, flags, timeout);
+    }
+    //timeout作为本次调用的截止时间; 真实调用在非阻塞socket上进行, 不再传给内核
+    //与内核一样, 返回时timeout改为剩余时间
+    uint64_t end_ms = server::GetCurrentMS() + timeout->tv_sec * 1000ull + timeout->tv_nsec / 1000 / 1000;
+    int n = do_io_until(sockfd, recvmmsg_f, "recvmmsg", server::IOManager::READ, SO_RCVTIMEO, end_ms,
+            msgvec, vlen, flags, (struct timespec*)nullptr);
+    int err = errno;
+    uint64_t now_ms = server::GetCurrentMS();
+    uint64_t remain_ms = end_ms > now_ms ? end_ms - now_ms : 0;
+    timeout->tv_sec = remain_ms / 1000;
+    timeout->tv_nsec = remain_ms % 1000 * 1000 * 1000;
+    errno = err;
+    return n;
+}
+
 ssize_t write(int fd, const void *buf, size_t count) {
     return do_io(fd, write_f, "write", server::IOManager::WRITE, SO_SNDTIMEO, buf, count);
 }
@@ -467,4 +898,145 @@ ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
     return do_io(sockfd, sendmsg_f, "sendmsg", server::IOManager::WRITE, SO_SNDTIMEO, msg, flags);  
 }
 
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+    return do_io(sockfd, sendmmsg_f, "sendmmsg", server::IOManager::WRITE, SO_SNDTIMEO, msgvec, vlen, flags);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    if(fd_closing(in_fd)) {
+        return -1;
+    }
+    return do_io(out_fd, sendfile_f, "sendfile", server::IOManager::WRITE, SO_SNDTIMEO, in_fd, offset, count);
+}
+
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags) {
+    if(fd_closing(fd_out)) {
+        return -1;
+    }
+    if(!server::t_hook_enable) {
+        return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+    }
+    //一端必须是管道; 另一端是socket时在socket上等待, 否则按fd_in处理(普通文件交给线程池)
+    server::FdCtx* ctx = server::FdMgr::GetInstance()->get(fd_out);
+    if(ctx && ctx->isSocket()) {
+        auto to_socket = [=](int fd) {
+            return splice_f(fd_in, off_in, fd, off_out, len, flags);
+        };
+        return do_io(fd_out, to_socket, "splice", server::IOManager::WRITE, SO_SNDTIMEO);
+    }
+    auto from_fd = [=](int fd) {
+        return splice_f(fd, off_in, fd_out, off_out, len, flags);
+    };
+    return do_io(fd_in, from_fd, "splice", server::IOManager::READ, SO_RCVTIMEO);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    if(!server::t_hook_enable) {
+        return poll_f(fds, nfds, timeout);
+    }
+    return do_poll(fds, nfds, timeout);
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
+    if(!server::t_hook_enable) {
+        return select_f(nfds, readfds, writefds, exceptfds, timeout);
+    }
+    //转换成pollfd数组走do_poll
+    std::vector<struct pollfd> pfds;
+    for(int fd = 0; fd < nfds; ++fd) {
+        short events = 0;
+        if(readfds && FD_ISSET(fd, readfds)) {
+            events |= POLLIN;
+        }
+        if(writefds && FD_ISSET(fd, writefds)) {
+            events |= POLLOUT;
+        }
+        if(exceptfds && FD_ISSET(fd, exceptfds)) {
+            events |= POLLPRI;
+        }
+        if(events) {
+            struct pollfd pfd = {fd, events, 0};
+            pfds.push_back(pfd);
+        }
+    }
+    int timeout_ms = -1;
+    uint64_t begin_ms = server::GetCurrentMS();
+    if(timeout) {
+        timeout_ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+    }
+    int rt = do_poll(pfds.data(), pfds.size(), timeout_ms);
+    if(rt < 0) {
+        return rt;
+    }
+    for(auto& pfd : pfds) {
+        if(pfd.revents & POLLNVAL) {
+            errno = EBADF;
+            return -1;
+        }
+    }
+
+    int count = 0;
+    for(auto& pfd : pfds) {
+        if(readfds && FD_ISSET(pfd.fd, readfds)) {
+            if(pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+                ++count;
+            } else {
+                FD_CLR(pfd.fd, readfds);
+            }
+        }
+        if(writefds && FD_ISSET(pfd.fd, writefds)) {
+            if(pfd.revents & (POLLOUT | POLLERR)) {
+                ++count;
+            } else {
+                FD_CLR(pfd.fd, writefds);
+            }
+        }
+        if(exceptfds && FD_ISSET(pfd.fd, exceptfds)) {
+            if(pfd.revents & POLLPRI) {
+                ++count;
+            } else {
+                FD_CLR(pfd.fd, exceptfds);
+            }
+        }
+    }
+    //与Linux行为一致, timeout改写为剩余时间
+    if(timeout) {
+        uint64_t used_ms = server::GetCurrentMS() - begin_ms;
+        uint64_t left_ms = (uint64_t)timeout_ms > used_ms ? timeout_ms - used_ms : 0;
+        timeout->tv_sec = left_ms / 1000;
+        timeout->tv_usec = left_ms % 1000 * 1000;
+    }
+    return count;
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+    if(!server::t_hook_enable) {
+        return epoll_wait_f(epfd, events, maxevents, timeout);
+    }
+    //epoll fd本身可读表示有就绪事件, 在它上面poll等待
+    uint64_t end_ms = timeout < 0 ? (uint64_t)-1 : server::GetCurrentMS() + timeout;
+    while(true) {
+        int rt = epoll_wait_f(epfd, events, maxevents, 0);
+        if(rt != 0 || timeout == 0) {
+            return rt;
+        }
+        int wait_ms = -1;
+        if(end_ms != (uint64_t)-1) {
+            uint64_t now_ms = server::GetCurrentMS();
+            if(now_ms >= end_ms) {
+                return 0;
+            }
+            wait_ms = end_ms - now_ms;
+        }
+        struct pollfd pfd = {epfd, POLLIN, 0};
+        rt = do_poll(&pfd, 1, wait_ms);
+        if(rt < 0) {
+            return rt;
+        }
+        if(rt == 0) {
+            return epoll_wait_f(epfd, events, maxevents, 0);
+        }
+    }
+}
+
 }
@@ -6,12 +6,29 @@
 #include <sys/socket.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include <poll.h>
 
 namespace server {
     
 bool is_hook_enable();
 void set_hook_enable(bool flag);
 
+//作用域内关闭当前线程的hook, 用于持锁执行的阻塞写(如日志), 避免持锁时协程被挂起
+class HookDisableGuard {
+public:
+    HookDisableGuard() : m_old(is_hook_enable()) {
+        set_hook_enable(false);
+    }
+    ~HookDisableGuard() {
+        set_hook_enable(m_old);
+    }
+private:
+    bool m_old;
+};
+
 }
 
 extern "C" {
@@ -36,6 +53,9 @@ extern connect_fun connect_f;
 typedef  int (*accept_fun)(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 extern accept_fun accept_f;
 
+typedef int (*accept4_fun)(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+extern accept4_fun accept4_f;
+
 typedef int (*close_fun)(int fd);
 extern close_fun close_f;
 
@@ -67,6 +87,9 @@ extern recvfrom_fun recvfrom_f;
 typedef ssize_t (*recvmsg_fun)(int sockfd, struct msghdr *msg, int flags);
 extern recvmsg_fun recvmsg_f;
 
+typedef int (*recvmmsg_fun)(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout);
+extern recvmmsg_fun recvmmsg_f;
+
 //write
 typedef ssize_t (*write_fun)(int fd, const void *buf, size_t count);
 extern write_fun write_f;
@@ -83,5 +106,28 @@ extern sendto_fun sendto_f;
 typedef ssize_t (*sendmsg_fun)(int sockfd, const struct msghdr *msg, int flags);
 extern sendmsg_fun sendmsg_f;
 
+typedef int (*sendmmsg_fun)(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+extern sendmmsg_fun sendmmsg_f;
+
+//zero copy
+typedef ssize_t (*sendfile_fun)(int out_fd, int in_fd, off_t *offset, size_t count);
+extern sendfile_fun sendfile_f;
+
+typedef ssize_t (*splice_fun)(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
+extern splice_fun splice_f;
+
+//multiplex
+typedef int (*poll_fun)(struct pollfd *fds, nfds_t nfds, int timeout);
+extern poll_fun poll_f;
+
+typedef int (*select_fun)(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout);
+extern select_fun select_f;
+
+typedef int (*epoll_wait_fun)(int epfd, struct epoll_event *events, int maxevents, int timeout);
+extern epoll_wait_fun epoll_wait_f;
+
+//带超时的connect, hook开启时协程挂起等待
+int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addrlen, uint64_t timeout_ms);
+
 }
 
@@ -1,6 +1,8 @@
 #include "iomanager.h"
 #include "macro.h"
 #include "log.h"
+#include "hook.h"
+#include "fd_manager.h"
 #include <sys/epoll.h>
 #include <unistd.h>
 #include <string.h>
@@ -17,6 +19,8 @@ IOManager::FdContext::EventContext& IOManager::FdContext::getContext(Event event
             return read;
         case IOManager::WRITE:
             return write;
+        case IOManager::ERROR:
+            return error;
         default:
             SERVER_ASSERT2(false, "getContext");
     }
@@ -35,10 +39,14 @@ void IOManager::FdContext::triggerEvent(Event event) {
     if(ctx.cb) {
         ctx.scheduler->schedule(&ctx.cb);
     }
-    else {
+    else if(ctx.fiber) {
         ctx.scheduler->schedule(&ctx.fiber);
     }
     ctx.scheduler = nullptr;
+    for(auto& i : ctx.waiters) {
+        i.scheduler->schedule(&i.cb);
+    }
+    ctx.waiters.clear();
     return;
 }
 
@@ -74,6 +82,10 @@ IOManager::~IOManager() {
     close(m_tickleFds[1]);
 
     for(size_t i = 0; i < m_fdContexts.size(); ++i) {
+        FdCtx* ctx = FdMgr::GetInstance()->get(i);
+        if(ctx) {
+            ctx->clearIOManager(this);
+        }
         if(m_fdContexts[i]) {
             delete m_fdContexts[i];
         }
@@ -92,7 +104,7 @@ void IOManager::contextResize(size_t size) {
 }
 
 // 1 success  0 retry  -1 error
-int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
+int IOManager::addEvent(int fd, Event event, Callback cb) {
     FdContext* fd_ctx = nullptr;
     RWMutexType::ReadLock rlock(m_mutex);
     if((int)m_fdContexts.size() > fd) {
@@ -107,7 +119,13 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
     }
 
     FdContext::MutexType::Lock fdlock(fd_ctx->mutex);
+    FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
     if(fd_ctx->events & event) {
+        //只有等待者时已在epoll中, 直接成为所有者
+        if(!event_ctx.waiters.empty() && !event_ctx.fiber && !event_ctx.cb) {
+            setOwner(event_ctx, std::move(cb));
+            return 0;
+        }
         SERVER_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd << " event=" << event
                                    << " fd_ctx.event=" << fd_ctx->events;
         SERVER_ASSERT(!(fd_ctx->events & event));
@@ -128,8 +146,12 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
 
     ++m_pendingEventCount;
     fd_ctx->events = (Event)(fd_ctx->events | event);
-    FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
     SERVER_ASSERT(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb);
+    setOwner(event_ctx, std::move(cb));
+    return 0;
+}
+
+void IOManager::setOwner(FdContext::EventContext& event_ctx, Callback cb) {
     event_ctx.scheduler = Scheduler::GetThis();
     if(cb) {
         event_ctx.cb.swap(cb);
@@ -138,9 +160,92 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
         event_ctx.fiber = Fiber::GetThis();
         SERVER_ASSERT2(event_ctx.fiber->getState() == Fiber::EXEC, "state=" << event_ctx.fiber->getState());
     }
+}
+
+int IOManager::addWaiter(int fd, Event event, Callback cb, uint64_t& id) {
+    FdContext* fd_ctx = nullptr;
+    RWMutexType::ReadLock rlock(m_mutex);
+    if((int)m_fdContexts.size() > fd) {
+        fd_ctx = m_fdContexts[fd];
+        rlock.unlock();
+    }
+    else {
+        rlock.unlock();
+        RWMutexType::WriteLock wlock(m_mutex);
+        contextResize(fd * 1.5);
+        fd_ctx = m_fdContexts[fd];
+    }
+
+    FdContext::MutexType::Lock fdlock(fd_ctx->mutex);
+    if(!(fd_ctx->events & event)) {
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        epevent.events = EPOLLET | fd_ctx->events | event;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if(rt) {
+            SERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << op << ", "
+                                       << fd << ", " << epevent.events << "):" << rt 
+                                       << " (" << errno << ") (" << strerror(errno) << ")";
+            return -1;
+        }
+        ++m_pendingEventCount;
+        fd_ctx->events = (Event)(fd_ctx->events | event);
+    }
+
+    FdContext::Waiter waiter;
+    waiter.id = ++m_nextWaiterId;
+    waiter.scheduler = Scheduler::GetThis();
+    waiter.cb = std::move(cb);
+    id = waiter.id;
+    fd_ctx->getContext(event).waiters.push_back(std::move(waiter));
     return 0;
 }
 
+bool IOManager::delWaiter(int fd, Event event, uint64_t id) {
+    RWMutexType::ReadLock rlock(m_mutex);
+    if((int)m_fdContexts.size() <= fd) {
+        return false;
+    }
+    FdContext* fd_ctx = m_fdContexts[fd];
+    rlock.unlock();
+
+    FdContext::MutexType::Lock fdlock(fd_ctx->mutex);
+    if(!(fd_ctx->events & event)) {
+        return false;
+    }
+    FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
+    auto it = event_ctx.waiters.begin();
+    while(it != event_ctx.waiters.end() && it->id != id) {
+        ++it;
+    }
+    if(it == event_ctx.waiters.end()) {
+        return false;
+    }
+    event_ctx.waiters.erase(it);
+    if(!event_ctx.waiters.empty() || event_ctx.fiber || event_ctx.cb) {
+        return true;
+    }
+
+    Event new_events = (Event)(fd_ctx->events & ~event);
+    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    epoll_event epevent;
+    epevent.events = EPOLLET | new_events;
+    epevent.data.ptr = fd_ctx;
+
+    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    if(rt) {
+        SERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << op << ", "
+                                   << fd << ", " << epevent.events << "):" << rt 
+                                   << " (" << errno << ") (" << strerror(errno) << ")";
+        return true;
+    }
+    --m_pendingEventCount;
+    fd_ctx->events = new_events;
+    return true;
+}
+
 bool IOManager::delEvent(int fd, Event event) {
     RWMutexType::ReadLock rlock(m_mutex);
     if((int)m_fdContexts.size() <= fd) {
@@ -153,6 +258,15 @@ bool IOManager::delEvent(int fd, Event event) {
     if(!(fd_ctx->events & event)) {
         return false;
     }
+    FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
+    //还有等待者时保留epoll中的事件, 只删除所有者
+    if(!event_ctx.waiters.empty()) {
+        if(!event_ctx.fiber && !event_ctx.cb) {
+            return false;
+        }
+        fd_ctx->resetContext(event_ctx);
+        return true;
+    }
 
     Event new_events = (Event)(fd_ctx->events & ~event);
     int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
@@ -170,7 +284,6 @@ bool IOManager::delEvent(int fd, Event event) {
 
     --m_pendingEventCount;
     fd_ctx->events = new_events;
-    FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
     fd_ctx->resetContext(event_ctx);
     return true;
 }
@@ -241,10 +354,26 @@ bool IOManager::cancelAll(int fd) {
         fd_ctx->triggerEvent(WRITE);
         --m_pendingEventCount;
     }
+    if(fd_ctx->events & ERROR) {
+        fd_ctx->triggerEvent(ERROR);
+        --m_pendingEventCount;
+    }
     SERVER_ASSERT(fd_ctx->events == 0);
     return true;    
 }
 
+bool IOManager::hasEvent(int fd, Event event) {
+    RWMutexType::ReadLock rlock(m_mutex);
+    if((int)m_fdContexts.size() <= fd) {
+        return false;
+    }
+    FdContext* fd_ctx = m_fdContexts[fd];
+    rlock.unlock();
+
+    FdContext::MutexType::Lock fdlock(fd_ctx->mutex);
+    return fd_ctx->events & event;
+}
+
 IOManager* IOManager::GetThis() {
     return dynamic_cast<IOManager*>(Scheduler::GetThis());
 }
@@ -282,6 +411,11 @@ void IOManager::idle() {
             SERVER_LOG_INFO(g_logger) << "name=" << getName() << " idle stopping exit";
             break;
         }
+        if(canRetire()) {
+            break;
+        }
+        //弹性模式下至少每个冷却周期醒来一次检查是否退出
+        next_timeout = std::min(next_timeout, getRetireCheckMs());
 
         int rt = 0;
         do {
@@ -293,7 +427,8 @@ void IOManager::idle() {
                 next_timeout = MAX_TIMEOUT;
             }
             // SERVER_LOG_INFO(g_logger) << next_timeout;
-            rt = epoll_wait(m_epfd, events, 64, (int)next_timeout);
+            //epoll_wait已被hook, 调度器自身必须调用原始函数
+            rt = epoll_wait_f(m_epfd, events, 64, (int)next_timeout);
             // SERVER_LOG_INFO(g_logger) << "epoll_wait back";
 
             if(rt < 0 && errno == EINTR) {
@@ -304,7 +439,7 @@ void IOManager::idle() {
             }
         } while(true);
 
-        std::vector<std::function<void()>> cbs;
+        std::vector<Callback> cbs;
         listExpiredCb(cbs);
         if(!cbs.empty()) {
             // SERVER_LOG_INFO(g_logger) << "schedule";
@@ -324,7 +459,10 @@ void IOManager::idle() {
 
             FdContext* fd_ctx = (FdContext*)event.data.ptr;
             FdContext::MutexType::Lock fdlock(fd_ctx->mutex);
-            if(event.events & (EPOLLERR | EPOLLHUP)) {
+            //有ERROR订阅者时EPOLLERR只交给它(如ZeroCopySender取完成通知), 否则错误队列非空期间
+            //读写等待者会被反复唤醒又挂起; 订阅者发现不是完成通知时自行唤醒它们. EPOLLHUP总是唤醒
+            bool error_owned = (fd_ctx->events & ERROR) && !(event.events & EPOLLHUP);
+            if((event.events & (EPOLLERR | EPOLLHUP)) && !error_owned) {
                 event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
             }
             int real_events = NONE;
@@ -334,6 +472,9 @@ void IOManager::idle() {
             if(event.events & EPOLLOUT) {
                 real_events |= WRITE;
             }
+            if((event.events & (EPOLLERR | EPOLLHUP)) && (fd_ctx->events & ERROR)) {
+                real_events |= ERROR;
+            }
 
             if((fd_ctx->events & real_events) == NONE) {
                 continue;
@@ -358,12 +499,13 @@ void IOManager::idle() {
                 fd_ctx->triggerEvent(WRITE);
                 --m_pendingEventCount;
             }
+            if(real_events & ERROR) {
+                fd_ctx->triggerEvent(ERROR);
+                --m_pendingEventCount;
+            }
         }
 
-        Fiber::ptr cur = Fiber::GetThis();
-        auto raw_ptr = cur.get();
-        cur.reset();
-        raw_ptr->swapOut();
+        Fiber::GetThisRaw()->swapOut();
         // server::Fiber::YieldToHold();
     }
 }
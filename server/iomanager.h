@@ -13,15 +13,23 @@ public:
     enum Event {
         NONE = 0x0,
         READ = 0x1,     //EPOLLIN
-        WRITE = 0x4     //EPOLLOUT
+        WRITE = 0x4,    //EPOLLOUT
+        ERROR = 0x8     //EPOLLERR, socket出错或错误队列(如MSG_ZEROCOPY完成通知)非空
     };
 private:
     struct FdContext {
         typedef Mutex MutexType;
+        //poll等只关心就绪的等待者, 可以多个共用一个事件
+        struct Waiter {
+            uint64_t id = 0;
+            Scheduler* scheduler = nullptr;
+            Callback cb;
+        };
         struct EventContext {
             Scheduler* scheduler = nullptr;         //事件执行的scheduler
             Fiber::ptr fiber;                       //事件的协程
-            std::function<void()> cb;               //事件的回调函数
+            Callback cb;                            //事件的回调函数
+            std::vector<Waiter> waiters;            //事件触发时全部执行
         };
 
         EventContext& getContext(Event event);
@@ -30,6 +38,7 @@ private:
 
         EventContext read;      //读事件
         EventContext write;     //写事件
+        EventContext error;     //错误事件
         int fd = 0;             //事件关联的句柄
         Event events = NONE;    //已注册的事件
         MutexType mutex;
@@ -40,11 +49,19 @@ public:
     ~IOManager();
 
     // 0 success  -1 error
-    int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+    int addEvent(int fd, Event event, Callback cb = nullptr);
     bool delEvent(int fd, Event event);
     bool cancelEvent(int fd, Event event);
 
     bool cancelAll(int fd);
+    //fd上是否已注册event
+    bool hasEvent(int fd, Event event);
+
+    //在fd的FdContext锁内注册等待者: 事件未注册时注册到epoll, 已注册(不论属于谁)时加入等待列表
+    //事件触发或被取消时所有等待者的回调都会执行一次; 成功返回0并通过id返回等待者编号, 失败返回-1
+    int addWaiter(int fd, Event event, Callback cb, uint64_t& id);
+    //删除编号为id的等待者, 已触发(不在列表中)时返回false; 事件没有其他等待者和所有者时从epoll删除
+    bool delWaiter(int fd, Event event, uint64_t id);
 
     static IOManager* GetThis();
 
@@ -56,11 +73,15 @@ protected:
     void onTimerInsertedAtFront() override;
 
     void contextResize(size_t size);
+private:
+    //把当前协程或cb设为事件的所有者, 调用方持有FdContext锁
+    void setOwner(FdContext::EventContext& event_ctx, Callback cb);
 private:
     int m_epfd = 0;
     int m_tickleFds[2];
 
     std::atomic<size_t> m_pendingEventCount = {0};
+    std::atomic<uint64_t> m_nextWaiterId = {0};
     RWMutexType m_mutex;
     std::vector<FdContext*> m_fdContexts;
 };
@@ -1,17 +1,109 @@
 #include "log.h"
 #include "config.h"
+#include "hook.h"
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <string.h>
 
 namespace server {
 
+//有格式用到毫秒/微秒时, 日志时间改读精确时钟
+static std::atomic<bool> s_precise_time = {false};
+
+LogStreamBuf::LogStreamBuf() {
+    setp(m_inline, m_inline + INLINE_SIZE);
+}
+
+void LogStreamBuf::reset() {
+    m_spilled = false;
+    m_spill.clear();
+    setp(m_inline, m_inline + INLINE_SIZE);
+}
+
+LogStreamBuf::int_type LogStreamBuf::overflow(int_type c) {
+    if(!m_spilled) {
+        //内联数组写满, 之后的内容都追加到m_spill
+        m_spill.assign(pbase(), pptr());
+        m_spilled = true;
+        setp(nullptr, nullptr);
+    }
+    if(!traits_type::eq_int_type(c, traits_type::eof())) {
+        m_spill.push_back(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize LogStreamBuf::xsputn(const char* s, std::streamsize n) {
+    if(m_spilled) {
+        m_spill.append(s, n);
+        return n;
+    }
+    return std::streambuf::xsputn(s, n);
+}
+
+LogStream::LogStream()
+    :std::ostream(nullptr) {
+    rdbuf(&m_buf);
+    m_flags = flags();
+}
+
+void LogStream::reset() {
+    m_buf.reset();
+    std::ostream::clear();
+    flags(m_flags);
+    precision(6);
+    width(0);
+    fill(' ');
+}
+
 LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level, 
     const char* file, int32_t line, uint32_t elapse, uint32_t thread_id, 
-    uint32_t fiber_id, uint64_t time, const std::string& thread_name)
+    uint32_t fiber_id, uint64_t time, const std::string& thread_name, uint32_t usec)
     : m_file(file), m_line(line), m_elapse(elapse), m_threadId(thread_id), 
-    m_fiberId(fiber_id), m_time(time), m_threadName(thread_name), 
+    m_fiberId(fiber_id), m_time(time), m_usec(usec), m_threadName(thread_name), 
     m_logger(logger), m_level(level) {
 
     }
 
+void LogEvent::reset(std::shared_ptr<Logger> logger, LogLevel::Level level,
+    const char* file, int32_t line, uint32_t elapse, uint32_t thread_id,
+    uint32_t fiber_id, uint64_t time, const std::string& thread_name, uint32_t usec) {
+    m_file = file;
+    m_line = line;
+    m_elapse = elapse;
+    m_threadId = thread_id;
+    m_fiberId = fiber_id;
+    m_time = time;
+    m_usec = usec;
+    //赋值复用已有的空间
+    m_threadName = thread_name;
+    m_ss.reset();
+    m_logger = std::move(logger);
+    m_level = level;
+}
+
+LogEvent::ptr LogEvent::GetThreadEvent(std::shared_ptr<Logger> logger, LogLevel::Level level,
+    const char* file, int32_t line) {
+    static thread_local LogEvent::ptr t_event;
+    //没有格式用到亚秒时读粗粒度时钟: 内核每个tick更新的缓存值, 不读硬件计数器
+    struct timespec ts;
+    clock_gettime(s_precise_time.load(std::memory_order_relaxed)
+            ? CLOCK_REALTIME : CLOCK_REALTIME_COARSE, &ts);
+    uint32_t usec = ts.tv_nsec / 1000;
+    if(t_event && t_event.use_count() == 1) {
+        t_event->reset(std::move(logger), level, file, line, 0, GetThreadId(),
+                GetFiberId(), ts.tv_sec, Thread::GetName(), usec);
+        return t_event;
+    }
+    LogEvent::ptr event(new LogEvent(std::move(logger), level, file, line, 0,
+                GetThreadId(), GetFiberId(), ts.tv_sec, Thread::GetName(), usec));
+    if(!t_event) {
+        t_event = event;
+    }
+    return event;
+}
+
 void LogEvent::format(const char* fmt, ...){
     va_list al;
     va_start(al, fmt);
@@ -19,11 +111,24 @@ void LogEvent::format(const char* fmt, ...){
     va_end(al);
 }
 void LogEvent::format(const char* fmt, va_list al){
-    char* buf = nullptr;
-    int len = vasprintf(&buf, fmt, al);
+    char buf[1024];
+    va_list ap;
+    va_copy(ap, al);
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if(len < 0) {
+        return;
+    }
+    if((size_t)len < sizeof(buf)) {
+        m_ss.write(buf, len);
+        return;
+    }
+    //超出栈上缓冲区才分配
+    char* big = nullptr;
+    len = vasprintf(&big, fmt, al);
     if(len != -1){
-        m_ss << std::string(buf, len);
-        free(buf);
+        m_ss.write(big, len);
+        free(big);
     }
 }
 
@@ -77,7 +182,7 @@ LogEventWrap::LogEventWrap(LogEvent::ptr e)
 LogEventWrap::~LogEventWrap(){
     m_event->getLogger()->log(m_event->getLevel(), m_event);
 }
-std::stringstream& LogEventWrap::getSS(){
+std::ostream& LogEventWrap::getSS(){
     return m_event->getSS();
 }
 
@@ -100,15 +205,15 @@ LogFormatter::ptr LogAppender::getFormatter() {
 class MessageFormatItem : public LogFormatter::FormatItem {
 public:
     MessageFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override{
-        os << event->getContent();
+    void format(std::ostream& os, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) override{
+        os.write(event->getContentData(), event->getContentSize());
     }
 };
 
 class LevelFormatItem : public LogFormatter::FormatItem {
 public:
     LevelFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override{
+    void format(std::ostream& os, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) override{
         os << LogLevel::ToString(level);
     }
 };
@@ -116,7 +221,7 @@ public:
 class ElapseFormatItem : public LogFormatter::FormatItem {
 public:
     ElapseFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override{
+    void format(std::ostream& os, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) override{
         os << event->getElapse();
     }
 };
@@ -124,7 +229,7 @@ public:
 class NameFormatItem : public LogFormatter::FormatItem {
 public:
     NameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override{
+    void format(std::ostream& os, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) override{
         os << event->getLogger()->getName();
     }
 };
@@ -132,7 +237,7 @@ public:
 class ThreadIdFormatItem : public LogFormatter::FormatItem {
 public:
     ThreadIdFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override{
+    void format(std::ostream& os, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) override{
         os << event->getThreadId();
     }
 };
@@ -140,7 +245,7 @@ public:
 class ThreadNameFormatItem : public LogFormatter::FormatItem {
 public:
     ThreadNameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override{
+    void format(std::ostream& os, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) override{
         os << event->getThreadName();
     }
 };
@@ -148,35 +253,119 @@ public:
 class FiberIdFormatItem : public LogFormatter::FormatItem {
 public:
     FiberIdFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override{
+    void format(std::ostream& os, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) override{
         os << event->getFiberId();
     }
 };
 
+static std::atomic<uint64_t> s_date_item_id = {0};
+
+//时间格式, 除strftime的格式外支持%L(3位毫秒)和%f(6位微秒)
+//按秒缓存strftime的结果, 每个线程缓存最近几个格式, 同一秒内的日志只填亚秒部分
 class DateTimeFormatItem : public LogFormatter::FormatItem {
 public:
     DateTimeFormatItem(const std::string format = "%Y-%m-%d %H:%M:%S")
-        :m_format(format){
+        :m_format(format)
+        ,m_id(++s_date_item_id) {
             if(m_format.empty()){
                 m_format = "%Y-%m-%d %H:%M:%S";
             }
+            parse();
+        }
+    void format(std::ostream& os, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) override{
+        Cache& cache = t_cache[m_id % CACHE_SIZE];
+        uint64_t sec = event->getTime();
+        if(cache.id != m_id || cache.sec != sec) {
+            fill(cache, sec);
+        }
+        if(!cache.nsub) {
+            os.write(cache.buf, cache.len);
+            return;
+        }
+        char buf[sizeof(cache.buf)];
+        memcpy(buf, cache.buf, cache.len);
+        for(int i = 0; i < cache.nsub; ++i) {
+            uint32_t v = event->getMicrosecond();
+            if(cache.width[i] == 3) {
+                v /= 1000;
+            }
+            for(int j = cache.width[i] - 1; j >= 0; --j) {
+                buf[cache.pos[i] + j] = '0' + v % 10;
+                v /= 10;
+            }
+        }
+        os.write(buf, cache.len);
+    }
+private:
+    static const int CACHE_SIZE = 4;
+    static const int MAX_SUB = 4;
+
+    //某一秒格式化后的结果, 亚秒部分先留空位
+    struct Cache {
+        uint64_t id = 0;
+        uint64_t sec = 0;
+        char buf[128];
+        size_t len = 0;
+        int nsub = 0;
+        size_t pos[MAX_SUB];
+        int width[MAX_SUB];
+    };
+
+    //按%L/%f把格式拆成若干段, 每段是strftime格式加上其后的亚秒宽度(0表示没有)
+    void parse() {
+        std::string cur;
+        for(size_t i = 0; i < m_format.size(); ++i) {
+            if(m_format[i] == '%' && i + 1 < m_format.size()) {
+                char c = m_format[++i];
+                if((c == 'L' || c == 'f') && m_pieces.size() < MAX_SUB) {
+                    m_pieces.push_back(std::make_pair(cur, c == 'L' ? 3 : 6));
+                    cur.clear();
+                    s_precise_time = true;
+                } else {
+                    cur.append(1, '%').append(1, c);
+                }
+                continue;
+            }
+            cur.append(1, m_format[i]);
         }
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override{
+        m_pieces.push_back(std::make_pair(cur, 0));
+    }
+
+    void fill(Cache& cache, uint64_t sec) {
         struct tm tm;
-        time_t time = event->getTime();
+        time_t time = sec;
         localtime_r(&time, &tm);
-        char buf[64];
-        strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-        os << buf;
+        cache.id = m_id;
+        cache.sec = sec;
+        cache.len = 0;
+        cache.nsub = 0;
+        for(auto& i : m_pieces) {
+            if(!i.first.empty()) {
+                cache.len += strftime(cache.buf + cache.len, sizeof(cache.buf) - cache.len,
+                        i.first.c_str(), &tm);
+            }
+            if(i.second && cache.len + i.second <= sizeof(cache.buf)) {
+                cache.pos[cache.nsub] = cache.len;
+                cache.width[cache.nsub] = i.second;
+                ++cache.nsub;
+                cache.len += i.second;
+            }
+        }
     }
 private:
     std::string m_format;
+    //区分线程缓存属于哪个格式
+    uint64_t m_id;
+    std::vector<std::pair<std::string, int> > m_pieces;
+    static thread_local Cache t_cache[CACHE_SIZE];
 };
 
+thread_local DateTimeFormatItem::Cache DateTimeFormatItem::t_cache[DateTimeFormatItem::CACHE_SIZE];
+
 class FilenameFormatItem : public LogFormatter::FormatItem {
 public:
     FilenameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override{
+    void format(std::ostream& os, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) override{
         os << event->getFile();
     }
 };
@@ -184,7 +373,7 @@ public:
 class LineFormatItem : public LogFormatter::FormatItem {
 public:
     LineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override{
+    void format(std::ostream& os, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) override{
         os << event->getLine();
     }
 };
@@ -192,8 +381,8 @@ public:
 class NewLineFormatItem : public LogFormatter::FormatItem {
 public:
     NewLineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override{
-        os << std::endl;
+    void format(std::ostream& os, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) override{
+        os << '\n';
     }
 };
 
@@ -201,7 +390,7 @@ class StringFormatItem : public LogFormatter::FormatItem {
 public:
     StringFormatItem(const std::string& str)
         :m_string(str){}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override{
+    void format(std::ostream& os, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) override{
         os << m_string;
     }
 private:
@@ -211,13 +400,14 @@ private:
 class TabFormatItem : public LogFormatter::FormatItem {
 public:
     TabFormatItem(const std::string& str = ""){}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override{
+    void format(std::ostream& os, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) override{
         os << "\t";
     }
 };
 
 Logger::Logger(const std::string& name)
-    : m_name(name), m_level(LogLevel::DEBUG) {
+    : m_name(name), m_level(LogLevel::DEBUG)
+    , m_appenders(new std::vector<LogAppender::ptr>) {
     m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
 }
 
@@ -225,7 +415,7 @@ void Logger::setFormatter(LogFormatter::ptr val) {
     MutexType::Lock lock(m_mutex);
     m_formatter = val;
 
-    for(auto& i : m_appenders) {
+    for(auto& i : *m_appenders) {
         MutexType::Lock ll(i->m_mutex);
         if(!i->m_hasFormatter) {
             i->m_formatter = m_formatter;
@@ -255,7 +445,7 @@ std::string Logger::toYamlString() {
     if(m_formatter) {
         node["formatter"] = m_formatter->getPattern();
     }
-    for(auto& i : m_appenders) {
+    for(auto& i : *m_appenders) {
         node["appenders"].push_back(YAML::Load(i->toYamlString()));
     }
     
@@ -275,30 +465,38 @@ void Logger::addAppender(LogAppender::ptr appender){
         MutexType::Lock ll(appender->m_mutex);
         appender->m_formatter = m_formatter;
     }
-    m_appenders.push_back(appender);
+    std::shared_ptr<std::vector<LogAppender::ptr> > appenders(
+            new std::vector<LogAppender::ptr>(*m_appenders));
+    appenders->push_back(appender);
+    m_appenders = appenders;
 }
 
 void Logger::delAppender(LogAppender::ptr appender){
     MutexType::Lock lock(m_mutex);
-    for(auto it = m_appenders.begin(); it != m_appenders.end(); ++it){
+    std::shared_ptr<std::vector<LogAppender::ptr> > appenders(
+            new std::vector<LogAppender::ptr>(*m_appenders));
+    for(auto it = appenders->begin(); it != appenders->end(); ++it){
         if(*it == appender){
-            m_appenders.erase(it);
+            appenders->erase(it);
             break;
         }
     }
+    m_appenders = appenders;
 }
 
 void Logger::clearAppenders() {
     MutexType::Lock lock(m_mutex);
-    m_appenders.clear();
+    m_appenders.reset(new std::vector<LogAppender::ptr>);
 }
 
 void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
     if(level >= m_level){
         auto self = shared_from_this();
         MutexType::Lock lock(m_mutex);
-        if(!m_appenders.empty()) {
-            for(auto& i : m_appenders) {
+        auto appenders = m_appenders;
+        lock.unlock();
+        if(!appenders->empty()) {
+            for(auto& i : *appenders) {
                 i->log(self, level, event);
             }
         }
@@ -329,10 +527,21 @@ void Logger::fatal(LogEvent::ptr event) {
     log(LogLevel::FATAL, event);
 }
 
+//格式化整行用的线程缓冲区
+static LogStream& GetThreadStream() {
+    static thread_local LogStream t_stream;
+    t_stream.reset();
+    return t_stream;
+}
+
 void StdoutLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
     if(level >= m_level) {
+        HookDisableGuard hook_guard;
+        LogStream& os = GetThreadStream();
         MutexType::Lock lock(m_mutex);
-        std::cout << m_formatter->format(logger, level, event);
+        m_formatter->format(os, logger, level, event);
+        //整行一次写出, 不和其他线程的输出交错
+        std::cout.write(os.data(), os.size());
     }
 }
 
@@ -351,30 +560,131 @@ std::string StdoutLogAppender::toYamlString() {
     return ss.str();
 }
 
-FileLogAppender::FileLogAppender(const std::string& filename)
-    :m_filename(filename) {
+static std::atomic<uint32_t> s_reopen_generation = {0};
+
+static void ReopenSignalHandler(int signo) {
+    FileLogAppender::ReopenAll();
+}
+
+void FileLogAppender::ReopenAll() {
+    ++s_reopen_generation;
+}
+
+uint32_t FileLogAppender::GetReopenGeneration() {
+    return s_reopen_generation.load(std::memory_order_relaxed);
+}
+
+void FileLogAppender::InstallReopenSignal(int signo) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = ReopenSignalHandler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(signo, &sa, nullptr);
+}
+
+FileLogAppender::FileLogAppender(const std::string& filename, uint64_t max_size,
+                                 uint32_t rotate_interval, uint32_t max_files)
+    :m_filename(filename)
+    ,m_maxSize(max_size)
+    ,m_rotateInterval(rotate_interval)
+    ,m_maxFiles(max_files) {
     
     reopen();
+    updateNextRotate(time(0));
 }
 
 bool FileLogAppender::reopen() {
     MutexType::Lock lock(m_mutex);
-    if(m_filestream){
+    return reopenLocked();
+}
+
+bool FileLogAppender::reopenLocked() {
+    if(m_filestream.is_open()){
         m_filestream.close();
     }
+    m_filestream.clear();
     m_filestream.open(m_filename, std::ios::app);
-    return !!m_filestream;
+    m_reopenGeneration = GetReopenGeneration();
+    struct stat st;
+    if(stat(m_filename.c_str(), &st) == 0) {
+        m_dev = st.st_dev;
+        m_ino = st.st_ino;
+        m_size = st.st_size;
+    } else {
+        m_dev = m_ino = m_size = 0;
+    }
+    return m_filestream.is_open();
+}
+
+void FileLogAppender::rotate() {
+    HookDisableGuard hook_guard;
+    MutexType::Lock lock(m_mutex);
+    rotateLocked();
+}
+
+void FileLogAppender::rotateLocked() {
+    m_filestream.close();
+    if(m_maxFiles == 0) {
+        unlink(m_filename.c_str());
+    } else {
+        //最旧的file.max_files被file.(max_files-1)覆盖
+        for(uint32_t i = m_maxFiles; i > 1; --i) {
+            std::string from = m_filename + "." + std::to_string(i - 1);
+            std::string to = m_filename + "." + std::to_string(i);
+            rename(from.c_str(), to.c_str());
+        }
+        rename(m_filename.c_str(), (m_filename + ".1").c_str());
+    }
+    reopenLocked();
+    updateNextRotate(time(0));
+}
+
+void FileLogAppender::updateNextRotate(uint64_t now) {
+    if(!m_rotateInterval) {
+        return;
+    }
+    struct tm tm;
+    time_t t = now;
+    localtime_r(&t, &tm);
+    int64_t off = tm.tm_gmtoff;
+    m_nextRotate = ((now + off) / m_rotateInterval + 1) * m_rotateInterval - off;
+}
+
+bool FileLogAppender::isMoved() {
+    struct stat st;
+    if(stat(m_filename.c_str(), &st)) {
+        return true;
+    }
+    return (uint64_t)st.st_dev != m_dev || (uint64_t)st.st_ino != m_ino;
 }
 
 void FileLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
     if(level >= m_level){
-        uint64_t now = time(0);
+        HookDisableGuard hook_guard;
+        uint64_t now = event->getTime();
+        //先格式化到线程缓冲区, 得到整行长度用于按大小轮转
+        LogStream& os = GetThreadStream();
+        MutexType::Lock lock(m_mutex);
+        m_formatter->format(os, logger, level, event);
         if(now != m_lastTime) {
-            reopen();
+            //每秒刷一次缓冲区, 检查一次文件状态, 不再每秒重新打开
             m_lastTime = now;
+            m_filestream.flush();
+            if(isMoved()) {
+                reopenLocked();
+            } else if(m_rotateInterval && now >= m_nextRotate) {
+                rotateLocked();
+            }
+        }
+        if(m_reopenGeneration != GetReopenGeneration()) {
+            reopenLocked();
+        }
+        m_filestream.write(os.data(), os.size());
+        m_size += os.size();
+        if(m_maxSize && m_size >= m_maxSize) {
+            rotateLocked();
         }
-        MutexType::Lock lock(m_mutex);
-        m_filestream << m_formatter->format(logger, level, event);
     }
 }
 
@@ -383,6 +693,15 @@ std::string FileLogAppender::toYamlString() {
     YAML::Node node;
     node["type"] = "FileLogAppender";
     node["file"] = m_filename;
+    if(m_maxSize) {
+        node["max_size"] = m_maxSize;
+    }
+    if(m_rotateInterval) {
+        node["rotate_interval"] = m_rotateInterval;
+    }
+    if(m_maxSize || m_rotateInterval) {
+        node["max_files"] = m_maxFiles;
+    }
     if(m_level != LogLevel::UNKNOW) {
         node["level"] = LogLevel::ToString(m_level);
     }
@@ -395,6 +714,526 @@ std::string FileLogAppender::toYamlString() {
     return ss.str();
 }
 
+const char* AsyncFileLogAppender::OverflowToString(Overflow val) {
+    switch(val) {
+        case DROP:
+            return "drop";
+        case DROP_LOW:
+            return "drop_low";
+        default:
+            return "block";
+    }
+}
+
+AsyncFileLogAppender::Overflow AsyncFileLogAppender::OverflowFromString(const std::string& str) {
+    if(str == "drop") {
+        return DROP;
+    }
+    if(str == "drop_low") {
+        return DROP_LOW;
+    }
+    return BLOCK;
+}
+
+AsyncFileLogAppender::AsyncFileLogAppender(const std::string& filename, uint32_t capacity, Overflow overflow)
+    :m_filename(filename)
+    ,m_capacity(2)
+    ,m_overflow(overflow) {
+    while(m_capacity < capacity) {
+        m_capacity <<= 1;
+    }
+    m_slots.reset(new Slot[m_capacity]);
+    for(uint32_t i = 0; i < m_capacity; ++i) {
+        m_slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+    openFile();
+    m_thread.reset(new Thread(std::bind(&AsyncFileLogAppender::run, this), "async_log"));
+}
+
+AsyncFileLogAppender::~AsyncFileLogAppender() {
+    m_stopping = true;
+    m_sem.notify();
+    m_thread->join();
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+void AsyncFileLogAppender::openFile() {
+    int fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        std::cout << "AsyncFileLogAppender open " << m_filename << " fail errno=" << errno << std::endl;
+        return;
+    }
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+    m_fd = fd;
+    m_reopenGeneration = FileLogAppender::GetReopenGeneration();
+}
+
+void AsyncFileLogAppender::reopen() {
+    m_reopen = true;
+    wakeup();
+}
+
+bool AsyncFileLogAppender::tryPush(std::string& data) {
+    uint64_t pos = m_tail.load(std::memory_order_relaxed);
+    while(true) {
+        Slot& slot = m_slots[pos & (m_capacity - 1)];
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)seq - (int64_t)pos;
+        if(diff == 0) {
+            if(m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.data.swap(data);
+                slot.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if(diff < 0) {
+            //上一轮的日志还没被取走, 队列满
+            return false;
+        } else {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+size_t AsyncFileLogAppender::pop(std::vector<std::string>& batch, size_t max) {
+    size_t count = 0;
+    while(count < max) {
+        Slot& slot = m_slots[m_head & (m_capacity - 1)];
+        if(slot.seq.load(std::memory_order_acquire) != m_head + 1) {
+            break;
+        }
+        //交换出字符串后立即归还槽位, 写文件时不占用队列
+        batch[count].swap(slot.data);
+        slot.seq.store(m_head + m_capacity, std::memory_order_release);
+        ++m_head;
+        ++count;
+    }
+    return count;
+}
+
+void AsyncFileLogAppender::wakeup() {
+    //与run中设置m_sleeping后再检查队列配对, 保证不会丢失唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_sleeping.load(std::memory_order_relaxed) && m_sleeping.exchange(false)) {
+        m_sem.notify();
+    }
+}
+
+void AsyncFileLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
+    if(level < m_level) {
+        return;
+    }
+    LogFormatter::ptr fmt;
+    {
+        MutexType::Lock lock(m_mutex);
+        fmt = m_formatter;
+    }
+    LogStream& os = GetThreadStream();
+    fmt->format(os, logger, level, event);
+    //和槽位交换字符串, 各槽位的空间在线程间轮转复用
+    static thread_local std::string t_data;
+    std::string& data = t_data;
+    data.assign(os.data(), os.size());
+    if(tryPush(data)) {
+        wakeup();
+        return;
+    }
+    if(m_overflow == DROP || (m_overflow == DROP_LOW && level < LogLevel::WARN)) {
+        ++m_dropped;
+        return;
+    }
+    //不让hook把等待变成协程切换, 日志调用方可能持有锁
+    HookDisableGuard hook_guard;
+    do {
+        wakeup();
+        usleep(100);
+    } while(!tryPush(data));
+    wakeup();
+}
+
+void AsyncFileLogAppender::flush() {
+    uint64_t target = m_tail.load();
+    HookDisableGuard hook_guard;
+    while(m_flushed.load() < target) {
+        wakeup();
+        usleep(100);
+    }
+}
+
+void AsyncFileLogAppender::writeBatch(std::vector<std::string>& batch, size_t count) {
+    struct iovec iov[64];
+    size_t i = 0;
+    while(i < count) {
+        int n = 0;
+        size_t total = 0;
+        for(; i < count && n < 64; ++i) {
+            iov[n].iov_base = &batch[i][0];
+            iov[n].iov_len = batch[i].size();
+            total += batch[i].size();
+            ++n;
+        }
+        struct iovec* cur = iov;
+        while(total > 0 && m_fd >= 0) {
+            ssize_t rt = writev(m_fd, cur, n);
+            if(rt < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                //磁盘出错时丢弃这一批, 不阻塞后续日志
+                break;
+            }
+            total -= rt;
+            while(n > 0 && (size_t)rt >= cur->iov_len) {
+                rt -= cur->iov_len;
+                ++cur;
+                --n;
+            }
+            if(n > 0) {
+                cur->iov_base = (char*)cur->iov_base + rt;
+                cur->iov_len -= rt;
+            }
+        }
+    }
+}
+
+void AsyncFileLogAppender::run() {
+    std::vector<std::string> batch(256);
+    while(true) {
+        if(m_reopen.exchange(false)
+                || m_reopenGeneration != FileLogAppender::GetReopenGeneration()) {
+            openFile();
+        }
+        size_t count = pop(batch, batch.size());
+        if(count > 0) {
+            writeBatch(batch, count);
+            m_written += count;
+            m_flushed.store(m_head);
+            for(size_t i = 0; i < count; ++i) {
+                batch[i].clear();
+            }
+            continue;
+        }
+        if(m_stopping) {
+            //生产者可能抢到了位置但还没写入槽位
+            if(m_tail.load() == m_head) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        m_sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        Slot& slot = m_slots[m_head & (m_capacity - 1)];
+        if(slot.seq.load(std::memory_order_acquire) == m_head + 1
+                || m_reopen || m_stopping) {
+            if(m_sleeping.exchange(false)) {
+                continue;
+            }
+            //生产者已经notify, 消耗掉这次信号
+        }
+        m_sem.wait();
+    }
+}
+
+std::string AsyncFileLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "AsyncFileLogAppender";
+    node["file"] = m_filename;
+    node["capacity"] = m_capacity;
+    node["overflow"] = OverflowToString(m_overflow);
+    if(m_level != LogLevel::UNKNOW) {
+        node["level"] = LogLevel::ToString(m_level);
+    }
+    if(m_hasFormatter && m_formatter) {
+        node["formatter"] = m_formatter->getPattern();
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+//二进制日志的记录类型
+enum BinaryRecord {
+    //会话头: 每次打开文件时写入, 之后的字典id重新编号
+    BINARY_SESSION = 0,
+    //调用点字典: id, level, line, file, logger
+    BINARY_SITE = 1,
+    //线程字典: id, tid, name
+    BINARY_THREAD = 2,
+    //日志: site, thread, fiber, sec, usec, elapse, content
+    BINARY_EVENT = 3
+};
+
+static const char s_binary_magic[] = "SLOGBIN";
+static const uint8_t s_binary_version = 1;
+
+static void PutVarint(std::string& buf, uint64_t v) {
+    while(v >= 0x80) {
+        buf.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    buf.push_back((char)v);
+}
+
+static void PutString(std::string& buf, const char* data, size_t len) {
+    PutVarint(buf, len);
+    buf.append(data, len);
+}
+
+BinaryLogAppender::BinaryLogAppender(const std::string& filename)
+    :m_filename(filename) {
+    reopenLocked();
+}
+
+BinaryLogAppender::~BinaryLogAppender() {
+    HookDisableGuard hook_guard;
+    flushLocked();
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+void BinaryLogAppender::reopenLocked() {
+    flushLocked();
+    int fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        std::cout << "BinaryLogAppender open " << m_filename << " fail errno=" << errno << std::endl;
+    }
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+    m_fd = fd;
+    m_reopenGeneration = FileLogAppender::GetReopenGeneration();
+    //新文件里没有之前的字典
+    m_sites.clear();
+    m_nextSiteId = 0;
+    m_threads.clear();
+    m_nextThreadId = 0;
+    m_buf.push_back((char)BINARY_SESSION);
+    m_buf.append(s_binary_magic, sizeof(s_binary_magic) - 1);
+    m_buf.push_back((char)s_binary_version);
+}
+
+void BinaryLogAppender::flush() {
+    HookDisableGuard hook_guard;
+    MutexType::Lock lock(m_mutex);
+    flushLocked();
+}
+
+void BinaryLogAppender::flushLocked() {
+    if(m_buf.empty() || m_fd < 0) {
+        return;
+    }
+    const char* ptr = m_buf.data();
+    size_t left = m_buf.size();
+    while(left > 0) {
+        ssize_t n = ::write(m_fd, ptr, left);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        ptr += n;
+        left -= n;
+        m_bytes += n;
+    }
+    m_buf.clear();
+}
+
+uint32_t BinaryLogAppender::getSiteId(const LogEvent::ptr& event, LogLevel::Level level) {
+    const Logger::ptr& logger = event->getLogger();
+    SiteKey key = {event->getFile(), event->getLine(), level, logger.get()};
+    auto it = m_sites.find(key);
+    if(it != m_sites.end() && !it->second.logger.expired()) {
+        return it->second.id;
+    }
+    uint32_t id = m_nextSiteId++;
+    SiteEntry& entry = m_sites[key];
+    entry.id = id;
+    entry.logger = logger;
+    const char* file = event->getFile() ? event->getFile() : "";
+    m_buf.push_back((char)BINARY_SITE);
+    PutVarint(m_buf, id);
+    m_buf.push_back((char)level);
+    PutVarint(m_buf, (uint32_t)event->getLine());
+    PutString(m_buf, file, strlen(file));
+    PutString(m_buf, logger->getName().data(), logger->getName().size());
+    return id;
+}
+
+uint32_t BinaryLogAppender::getThreadId(const LogEvent::ptr& event) {
+    auto it = m_threads.find(event->getThreadId());
+    if(it != m_threads.end() && it->second.name == event->getThreadName()) {
+        return it->second.id;
+    }
+    //新线程或线程改了名字
+    ThreadEntry& entry = m_threads[event->getThreadId()];
+    entry.name = event->getThreadName();
+    entry.id = m_nextThreadId++;
+    m_buf.push_back((char)BINARY_THREAD);
+    PutVarint(m_buf, entry.id);
+    PutVarint(m_buf, event->getThreadId());
+    PutString(m_buf, entry.name.data(), entry.name.size());
+    return entry.id;
+}
+
+void BinaryLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
+    if(level < m_level) {
+        return;
+    }
+    HookDisableGuard hook_guard;
+    MutexType::Lock lock(m_mutex);
+    if(m_reopenGeneration != FileLogAppender::GetReopenGeneration()) {
+        reopenLocked();
+    }
+    uint32_t site = getSiteId(event, level);
+    uint32_t thread = getThreadId(event);
+    m_buf.push_back((char)BINARY_EVENT);
+    PutVarint(m_buf, site);
+    PutVarint(m_buf, thread);
+    PutVarint(m_buf, event->getFiberId());
+    PutVarint(m_buf, event->getTime());
+    PutVarint(m_buf, event->getMicrosecond());
+    PutVarint(m_buf, event->getElapse());
+    PutString(m_buf, event->getContentData(), event->getContentSize());
+    //和FileLogAppender一样每秒至少写一次文件
+    if(m_buf.size() >= 64 * 1024 || event->getTime() != m_lastTime) {
+        m_lastTime = event->getTime();
+        flushLocked();
+    }
+}
+
+std::string BinaryLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "BinaryLogAppender";
+    node["file"] = m_filename;
+    if(m_level != LogLevel::UNKNOW) {
+        node["level"] = LogLevel::ToString(m_level);
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+bool BinaryLogReader::open(const std::string& filename) {
+    m_in.open(filename, std::ios::binary);
+    return m_in.is_open();
+}
+
+bool BinaryLogReader::readVarint(uint64_t& v) {
+    v = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+        int c = m_in.get();
+        if(c == EOF) {
+            return false;
+        }
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if(!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BinaryLogReader::readString(std::string& str) {
+    uint64_t len = 0;
+    if(!readVarint(len) || len > 64 * 1024 * 1024) {
+        return false;
+    }
+    str.resize(len);
+    return len == 0 || m_in.read(&str[0], len);
+}
+
+std::shared_ptr<Logger> BinaryLogReader::getLogger(const std::string& name) {
+    auto& logger = m_loggers[name];
+    if(!logger) {
+        logger.reset(new Logger(name));
+    }
+    return logger;
+}
+
+bool BinaryLogReader::next(LogEvent::ptr& event) {
+    while(true) {
+        int type = m_in.get();
+        if(type == EOF) {
+            return false;
+        }
+        switch(type) {
+            case BINARY_SESSION:
+                {
+                    char magic[sizeof(s_binary_magic)];
+                    if(!m_in.read(magic, sizeof(magic))
+                            || memcmp(magic, s_binary_magic, sizeof(s_binary_magic) - 1)
+                            || (uint8_t)magic[sizeof(magic) - 1] != s_binary_version) {
+                        m_error = true;
+                        return false;
+                    }
+                    m_sites.clear();
+                    m_threads.clear();
+                }
+                break;
+            case BINARY_SITE:
+                {
+                    uint64_t id = 0;
+                    uint64_t line = 0;
+                    std::string name;
+                    Site site;
+                    int level = 0;
+                    if(!readVarint(id) || id != m_sites.size() || (level = m_in.get()) == EOF
+                            || !readVarint(line) || !readString(site.file) || !readString(name)) {
+                        m_error = true;
+                        return false;
+                    }
+                    site.level = (LogLevel::Level)level;
+                    site.line = line;
+                    site.logger = getLogger(name);
+                    m_sites.push_back(site);
+                }
+                break;
+            case BINARY_THREAD:
+                {
+                    uint64_t id = 0;
+                    uint64_t tid = 0;
+                    ThreadInfo info;
+                    if(!readVarint(id) || id != m_threads.size() || !readVarint(tid)
+                            || !readString(info.name)) {
+                        m_error = true;
+                        return false;
+                    }
+                    info.tid = tid;
+                    m_threads.push_back(info);
+                }
+                break;
+            case BINARY_EVENT:
+                {
+                    uint64_t site = 0, thread = 0, fiber = 0, sec = 0, usec = 0, elapse = 0;
+                    if(!readVarint(site) || !readVarint(thread) || !readVarint(fiber)
+                            || !readVarint(sec) || !readVarint(usec) || !readVarint(elapse)
+                            || !readString(m_content)
+                            || site >= m_sites.size() || thread >= m_threads.size()) {
+                        m_error = true;
+                        return false;
+                    }
+                    const Site& s = m_sites[site];
+                    const ThreadInfo& t = m_threads[thread];
+                    event.reset(new LogEvent(s.logger, s.level, s.file.c_str(), s.line, elapse,
+                                t.tid, fiber, sec, t.name, usec));
+                    event->getSS().write(m_content.data(), m_content.size());
+                    return true;
+                }
+            default:
+                m_error = true;
+                return false;
+        }
+    }
+}
+
 LogFormatter::LogFormatter(const std::string& pattern)
     :m_pattern(pattern) {
         init();
@@ -402,10 +1241,16 @@ LogFormatter::LogFormatter(const std::string& pattern)
 
 std::string LogFormatter::format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event){
     std::stringstream ss;
+    format(ss, logger, level, event);
+    return ss.str(); 
+}
+
+std::ostream& LogFormatter::format(std::ostream& os, const std::shared_ptr<Logger>& logger,
+    LogLevel::Level level, const LogEvent::ptr& event) {
     for(auto& i : m_items){
-        i->format(ss, logger, level, event);
+        i->format(os, logger, level, event);
     }
-    return ss.str(); 
+    return os;
 }
 
 //%xxx  %xxx{xxx}  %%
@@ -541,16 +1386,26 @@ Logger::ptr LoggerManager::getLogger(const std::string& name){
 }
 
 struct LogAppenderDefine {
-    int type = 0;   //1 File, 2 Stdout
+    int type = 0;   //1 File, 2 Stdout, 3 AsyncFile, 4 Binary
     LogLevel::Level level = LogLevel::UNKNOW;
     std::string formatter;
     std::string file;
+    uint32_t capacity = 8192;
+    std::string overflow = "block";
+    uint64_t max_size = 0;
+    uint32_t rotate_interval = 0;
+    uint32_t max_files = 7;
 
     bool operator==(const LogAppenderDefine& oth) const {
         return type == oth.type &&
                level == oth.level &&
                formatter == oth.formatter &&
-               file == oth.file;
+               file == oth.file &&
+               capacity == oth.capacity &&
+               overflow == oth.overflow &&
+               max_size == oth.max_size &&
+               rotate_interval == oth.rotate_interval &&
+               max_files == oth.max_files;
     }
 };
 
@@ -609,10 +1464,44 @@ public:
                             continue;
                         }
                         lad.file = a["file"].as<std::string>();
+                        if(a["max_size"].IsDefined()) {
+                            lad.max_size = a["max_size"].as<uint64_t>();
+                        }
+                        if(a["rotate_interval"].IsDefined()) {
+                            lad.rotate_interval = a["rotate_interval"].as<uint32_t>();
+                        }
+                        if(a["max_files"].IsDefined()) {
+                            lad.max_files = a["max_files"].as<uint32_t>();
+                        }
                         if(a["formatter"].IsDefined()) {
                             lad.formatter = a["formatter"].as<std::string>();
                         }
                     }
+                    else if(type == "AsyncFileLogAppender") {
+                        lad.type = 3;
+                        if(!a["file"].IsDefined()) {
+                            std::cout << "log config error: flieappender is null, " << a << std::endl;
+                            continue;
+                        }
+                        lad.file = a["file"].as<std::string>();
+                        if(a["capacity"].IsDefined()) {
+                            lad.capacity = a["capacity"].as<uint32_t>();
+                        }
+                        if(a["overflow"].IsDefined()) {
+                            lad.overflow = a["overflow"].as<std::string>();
+                        }
+                        if(a["formatter"].IsDefined()) {
+                            lad.formatter = a["formatter"].as<std::string>();
+                        }
+                    }
+                    else if(type == "BinaryLogAppender") {
+                        lad.type = 4;
+                        if(!a["file"].IsDefined()) {
+                            std::cout << "log config error: flieappender is null, " << a << std::endl;
+                            continue;
+                        }
+                        lad.file = a["file"].as<std::string>();
+                    }
                     else if(type == "StdoutLogAppender") {
                         lad.type = 2;
                         if(a["formatter"].IsDefined()) {
@@ -651,10 +1540,27 @@ public:
                 if(a.type == 1) {
                     na["type"] = "FileLogAppender";
                     na["file"] = a.file;
+                    if(a.max_size) {
+                        na["max_size"] = a.max_size;
+                    }
+                    if(a.rotate_interval) {
+                        na["rotate_interval"] = a.rotate_interval;
+                    }
+                    na["max_files"] = a.max_files;
                 }
                 else if(a.type == 2) {
                     na["type"] = "StdoutLogAppender";
                 }
+                else if(a.type == 3) {
+                    na["type"] = "AsyncFileLogAppender";
+                    na["file"] = a.file;
+                    na["capacity"] = a.capacity;
+                    na["overflow"] = a.overflow;
+                }
+                else if(a.type == 4) {
+                    na["type"] = "BinaryLogAppender";
+                    na["file"] = a.file;
+                }
                 if(a.level != LogLevel::UNKNOW) {
                     na["level"] = LogLevel::ToString(a.level);
                 }
@@ -692,11 +1598,19 @@ struct LogIniter {
                 for(auto& a : i.appenders) {
                     server::LogAppender::ptr ap;
                     if(a.type == 1) {
-                        ap.reset(new FileLogAppender(a.file));
+                        ap.reset(new FileLogAppender(a.file, a.max_size,
+                                    a.rotate_interval, a.max_files));
                     }
                     else if(a.type == 2) {
                         ap.reset(new StdoutLogAppender);
                     }
+                    else if(a.type == 3) {
+                        ap.reset(new AsyncFileLogAppender(a.file, a.capacity,
+                                    AsyncFileLogAppender::OverflowFromString(a.overflow)));
+                    }
+                    else if(a.type == 4) {
+                        ap.reset(new BinaryLogAppender(a.file));
+                    }
                     ap->setLevel(a.level);
                     if(!a.formatter.empty()) {
                         LogFormatter::ptr fmt(new LogFormatter(a.formatter));
@@ -7,21 +7,28 @@
 #include <fstream>
 #include <vector>
 #include <list>
+#include <deque>
 #include <string>
 #include <unordered_map>
 #include <iostream>
 #include <functional>
 #include <ctime>
 #include <stdarg.h>
+#include <atomic>
 #include "util.h"
 #include "singleton.h"
 #include "thread.h"
 
+#ifndef SERVER_LOG_MIN_LEVEL
+//编译期的最低日志级别(LogLevel::Level的值), 低于它的日志语句被编译器整个去掉
+//如-DSERVER_LOG_MIN_LEVEL=2去掉所有DEBUG日志
+#define SERVER_LOG_MIN_LEVEL 0
+#endif
+
 #define SERVER_LOG_LEVEL(logger, level) \
-    if(logger->getLevel() <= level) \
-        server::LogEventWrap(server::LogEvent::ptr(new server::LogEvent(logger, level, \
-            __FILE__, __LINE__, 0, server::GetThreadId(), \
-                server::GetFiberId(), time(0), server::Thread::GetName()))).getSS()
+    if((int)(level) >= SERVER_LOG_MIN_LEVEL && logger->getLevel() <= level) \
+        server::LogEventWrap(server::LogEvent::GetThreadEvent(logger, level, \
+            __FILE__, __LINE__)).getSS()
 
 #define SERVER_LOG_DEBUG(logger) SERVER_LOG_LEVEL(logger, server::LogLevel::DEBUG)
 #define SERVER_LOG_INFO(logger) SERVER_LOG_LEVEL(logger, server::LogLevel::INFO)
@@ -30,10 +37,9 @@
 #define SERVER_LOG_FATAL(logger) SERVER_LOG_LEVEL(logger, server::LogLevel::FATAL)
 
 #define SERVER_LOG_FMT_LEVEL(logger, level, fmt, ...) \
-    if(logger->getLevel() <= level) \
-        server::LogEventWrap(server::LogEvent::ptr(new server::LogEvent(logger, level, \
-            __FILE__, __LINE__, 0, server::GetThreadId(), server::GetFiberId(), \
-                time(0), server::Thread::GetName()))).getEvent()->format(fmt, __VA_ARGS__)
+    if((int)(level) >= SERVER_LOG_MIN_LEVEL && logger->getLevel() <= level) \
+        server::LogEventWrap(server::LogEvent::GetThreadEvent(logger, level, \
+            __FILE__, __LINE__)).getEvent()->format(fmt, __VA_ARGS__)
 
 #define SERVER_LOG_FMT_DEBUG(logger, fmt, ...) SERVER_LOG_FMT_LEVEL(logger, server::LogLevel::DEBUG, fmt, __VA_ARGS__)
 #define SERVER_LOG_FMT_INFO(logger, fmt, ...) SERVER_LOG_FMT_LEVEL(logger, server::LogLevel::INFO, fmt, __VA_ARGS__)
@@ -65,13 +71,49 @@ public:
     static LogLevel::Level FromString(const std::string& str);
 };
 
+//日志内容的缓冲区: 先写入固定大小的内联数组, 超出后才转存到堆上
+class LogStreamBuf : public std::streambuf {
+public:
+    static const size_t INLINE_SIZE = 4096;
+
+    LogStreamBuf();
+    //清空内容, 保留已分配的空间
+    void reset();
+    const char* data() const { return m_spilled ? m_spill.data() : m_inline; }
+    size_t size() const { return m_spilled ? m_spill.size() : pptr() - pbase(); }
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+private:
+    bool m_spilled = false;
+    std::string m_spill;
+    char m_inline[INLINE_SIZE];
+};
+
+//基于LogStreamBuf的输出流, 可以反复reset复用
+class LogStream : public std::ostream {
+public:
+    LogStream();
+    //清空内容并恢复默认的格式标志
+    void reset();
+    const char* data() const { return m_buf.data(); }
+    size_t size() const { return m_buf.size(); }
+private:
+    LogStreamBuf m_buf;
+    std::ios::fmtflags m_flags;
+};
+
 //日志事件
 class LogEvent{
 public:
     typedef std::shared_ptr<LogEvent> ptr;
     LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level, const char* file,
         int32_t line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, 
-        uint64_t time, const std::string& thread_name);
+        uint64_t time, const std::string& thread_name, uint32_t usec = 0);
+
+    //取当前线程复用的日志事件, 不分配内存; 事件仍在使用中时(如输出日志内容时又打了日志)新建一个
+    static LogEvent::ptr GetThreadEvent(std::shared_ptr<Logger> logger, LogLevel::Level level,
+        const char* file, int32_t line);
 
     const char* getFile() const { return m_file; }
     int32_t getLine() const { return m_line; }
@@ -80,13 +122,21 @@ public:
     const std::string& getThreadName() const { return m_threadName; }
     uint32_t getFiberId() const { return m_fiberId; }
     uint64_t getTime() const { return m_time; }
-    std::string getContent() const { return m_ss.str(); }
+    //时间戳的微秒部分
+    uint32_t getMicrosecond() const { return m_usec; }
+    std::string getContent() const { return std::string(m_ss.data(), m_ss.size()); }
+    const char* getContentData() const { return m_ss.data(); }
+    size_t getContentSize() const { return m_ss.size(); }
     std::shared_ptr<Logger> getLogger() const { return m_logger; }
     LogLevel::Level getLevel() const { return m_level; }
 
-    std::stringstream& getSS() { return m_ss; }
+    std::ostream& getSS() { return m_ss; }
     void format(const char* fmt, ...);
     void format(const char* fmt, va_list al);
+private:
+    void reset(std::shared_ptr<Logger> logger, LogLevel::Level level, const char* file,
+        int32_t line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id,
+        uint64_t time, const std::string& thread_name, uint32_t usec);
 private:
     const char* m_file = nullptr;   //文件名
     int32_t m_line = 0;             //行号
@@ -94,8 +144,9 @@ private:
     uint32_t m_threadId = 0;        //线程id
     uint32_t m_fiberId = 0;         //协程id
     uint64_t m_time;                //时间戳
+    uint32_t m_usec = 0;            //时间戳的微秒部分
     std::string m_threadName;
-    std::stringstream m_ss;
+    LogStream m_ss;
 
     std::shared_ptr<Logger> m_logger;
     LogLevel::Level m_level;
@@ -105,7 +156,7 @@ class LogEventWrap {
 public:
     LogEventWrap(LogEvent::ptr e);
     ~LogEventWrap();
-    std::stringstream& getSS();
+    std::ostream& getSS();
     LogEvent::ptr getEvent() const { return m_event; }
 private:
     LogEvent::ptr m_event;
@@ -118,13 +169,16 @@ public:
     LogFormatter(const std::string& pattern);
 
     std::string format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);
+    //直接追加到os, 不产生中间字符串
+    std::ostream& format(std::ostream& os, const std::shared_ptr<Logger>& logger,
+        LogLevel::Level level, const LogEvent::ptr& event);
 public:
     class FormatItem{
     public:
         typedef std::shared_ptr<FormatItem> ptr;
         virtual ~FormatItem() {}
-        virtual void format(std::ostream& os, std::shared_ptr<Logger> logger,
-            LogLevel::Level level, LogEvent::ptr event) = 0;
+        virtual void format(std::ostream& os, const std::shared_ptr<Logger>& logger,
+            LogLevel::Level level, const LogEvent::ptr& event) = 0;
     };
 
     void init();
@@ -193,7 +247,8 @@ private:
     std::string m_name;                         //日志名称
     LogLevel::Level m_level;                    //日志级别
     MutexType m_mutex;
-    std::list<LogAppender::ptr> m_appenders;    //Appender集合
+    //Appender集合, 写时复制: log只在锁内取快照, 格式化和写入时不持有日志器的锁
+    std::shared_ptr<const std::vector<LogAppender::ptr> > m_appenders;
     LogFormatter::ptr m_formatter;
     Logger::ptr m_root;
 };
@@ -209,20 +264,237 @@ private:
 };
 
 //输出到文件的Appender
+//文件超过max_size字节或跨过rotate_interval秒的整点时轮转: file -> file.1 -> file.2 ..., 最多保留max_files个
+//每秒检查一次文件是否被移走或删除(如外部logrotate), 是则重新打开; 收到ReopenAll后在下一条日志前重新打开
 class FileLogAppender : public LogAppender {
 friend class Logger;
 public:
     typedef std::shared_ptr<FileLogAppender> ptr;
-    FileLogAppender(const std::string& filename);
+    //max_size, rotate_interval为0表示不按该条件轮转
+    FileLogAppender(const std::string& filename, uint64_t max_size = 0,
+                    uint32_t rotate_interval = 0, uint32_t max_files = 7);
     std::string toYamlString() override;
     void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
 
     //重新打开文件，打开成功返回true
     bool reopen();
+    //立即轮转
+    void rotate();
+
+    uint64_t getMaxSize() const { return m_maxSize; }
+    uint32_t getRotateInterval() const { return m_rotateInterval; }
+    uint32_t getMaxFiles() const { return m_maxFiles; }
+
+    //让所有文件Appender重新打开文件, 只修改原子变量, 可以在信号处理函数中调用
+    static void ReopenAll();
+    static uint32_t GetReopenGeneration();
+    //收到signo(如SIGHUP)时调用ReopenAll
+    static void InstallReopenSignal(int signo);
+private:
+    bool reopenLocked();
+    void rotateLocked();
+    //计算下一个按时间轮转的时刻, 按本地时间对齐
+    void updateNextRotate(uint64_t now);
+    //文件被移走或删除时返回true
+    bool isMoved();
 private:
     std::string m_filename;
     std::ofstream m_filestream;
-    uint64_t m_lastTime;
+    uint64_t m_lastTime = 0;
+    uint64_t m_maxSize;
+    uint32_t m_rotateInterval;
+    uint32_t m_maxFiles;
+    //当前文件大小
+    uint64_t m_size = 0;
+    uint64_t m_nextRotate = 0;
+    //打开时文件的设备号和inode
+    uint64_t m_dev = 0;
+    uint64_t m_ino = 0;
+    uint32_t m_reopenGeneration = 0;
+};
+
+//异步输出到文件的Appender
+//调用线程只格式化日志并放入无锁MPSC环形队列, 后台线程批量取出用writev写入文件
+class AsyncFileLogAppender : public LogAppender {
+friend class Logger;
+public:
+    typedef std::shared_ptr<AsyncFileLogAppender> ptr;
+
+    //队列满时的处理策略
+    enum Overflow {
+        //等待后台线程腾出空间
+        BLOCK = 0,
+        //丢弃新日志
+        DROP = 1,
+        //丢弃WARN以下的日志, WARN及以上等待
+        DROP_LOW = 2
+    };
+
+    static const char* OverflowToString(Overflow val);
+    //无法识别时返回BLOCK
+    static Overflow OverflowFromString(const std::string& str);
+
+    //capacity向上取整为2的幂
+    AsyncFileLogAppender(const std::string& filename, uint32_t capacity = 8192,
+                         Overflow overflow = BLOCK);
+    //写完队列中剩余的日志后退出后台线程
+    ~AsyncFileLogAppender();
+
+    std::string toYamlString() override;
+    void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
+
+    //后台线程在下一批写入前重新打开文件, FileLogAppender::ReopenAll同样生效
+    void reopen();
+    //等待调用前放入队列的日志都已写入文件
+    void flush();
+
+    uint32_t getCapacity() const { return m_capacity; }
+    Overflow getOverflow() const { return m_overflow; }
+    //因队列满丢弃的日志数
+    uint64_t getDropped() const { return m_dropped; }
+    //已写入文件的日志数
+    uint64_t getWritten() const { return m_written; }
+private:
+    struct Slot {
+        //等于入队位置时可写, 等于入队位置+1时可读
+        std::atomic<uint64_t> seq;
+        std::string data;
+    };
+
+    //队列满返回false
+    bool tryPush(std::string& data);
+    //取出最多max条日志, 返回条数
+    size_t pop(std::vector<std::string>& batch, size_t max);
+    void wakeup();
+    void run();
+    void openFile();
+    void writeBatch(std::vector<std::string>& batch, size_t count);
+private:
+    std::string m_filename;
+    int m_fd = -1;
+    uint32_t m_capacity;
+    Overflow m_overflow;
+    std::unique_ptr<Slot[]> m_slots;
+    //生产者争用的入队位置与消费者的出队位置分开, 避免伪共享
+    char m_pad0[64];
+    std::atomic<uint64_t> m_tail = {0};
+    char m_pad1[64];
+    uint64_t m_head = 0;
+    std::atomic<uint64_t> m_written = {0};
+    std::atomic<uint64_t> m_dropped = {0};
+    //后台线程已写完的队列位置
+    std::atomic<uint64_t> m_flushed = {0};
+    std::atomic<bool> m_sleeping = {false};
+    std::atomic<bool> m_reopen = {false};
+    //上次打开文件时FileLogAppender::GetReopenGeneration()的值
+    uint32_t m_reopenGeneration = 0;
+    std::atomic<bool> m_stopping = {false};
+    Semaphore m_sem;
+    std::unique_ptr<Thread> m_thread;
+};
+
+//二进制格式输出到文件的Appender, 不经过LogFormatter
+//每条日志只写调用点id、线程id、时间等原始字段和消息内容; 调用点(文件/行号/级别/日志名)和线程名
+//第一次出现时写一条字典记录. 用BinaryLogReader(或tools/log_decoder)按任意格式还原为文本
+class BinaryLogAppender : public LogAppender {
+friend class Logger;
+public:
+    typedef std::shared_ptr<BinaryLogAppender> ptr;
+    BinaryLogAppender(const std::string& filename);
+    //写出缓冲区中剩余的数据
+    ~BinaryLogAppender();
+
+    std::string toYamlString() override;
+    void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
+
+    //把缓冲区写入文件
+    void flush();
+    //已写入文件的字节数
+    uint64_t getBytes() const { return m_bytes; }
+private:
+    struct SiteKey {
+        const char* file;
+        int32_t line;
+        LogLevel::Level level;
+        Logger* logger;
+
+        bool operator==(const SiteKey& oth) const {
+            return file == oth.file && line == oth.line
+                && level == oth.level && logger == oth.logger;
+        }
+    };
+
+    struct SiteKeyHash {
+        size_t operator()(const SiteKey& key) const {
+            return std::hash<const void*>()(key.file) ^ ((size_t)key.line << 8)
+                ^ key.level ^ std::hash<const void*>()(key.logger);
+        }
+    };
+
+    struct SiteEntry {
+        uint32_t id;
+        //日志器销毁后地址可能被新的日志器复用, 此时字典项作废
+        std::weak_ptr<Logger> logger;
+    };
+
+    struct ThreadEntry {
+        std::string name;
+        uint32_t id;
+    };
+
+    //打开文件并写入会话头, 字典从头开始
+    void reopenLocked();
+    void flushLocked();
+    uint32_t getSiteId(const LogEvent::ptr& event, LogLevel::Level level);
+    uint32_t getThreadId(const LogEvent::ptr& event);
+private:
+    std::string m_filename;
+    int m_fd = -1;
+    //攒够一批或跨秒时再写文件
+    std::string m_buf;
+    uint64_t m_lastTime = 0;
+    uint64_t m_bytes = 0;
+    uint32_t m_reopenGeneration = 0;
+    std::unordered_map<SiteKey, SiteEntry, SiteKeyHash> m_sites;
+    uint32_t m_nextSiteId = 0;
+    //线程id -> 线程名和字典id
+    std::unordered_map<uint32_t, ThreadEntry> m_threads;
+    uint32_t m_nextThreadId = 0;
+};
+
+//读取BinaryLogAppender写出的文件, 逐条还原为LogEvent
+class BinaryLogReader {
+public:
+    //打开失败返回false
+    bool open(const std::string& filename);
+    //读下一条日志, 文件结束或数据损坏返回false
+    bool next(LogEvent::ptr& event);
+    //因数据损坏而停止
+    bool isError() const { return m_error; }
+private:
+    struct Site {
+        LogLevel::Level level;
+        int32_t line;
+        std::string file;
+        std::shared_ptr<Logger> logger;
+    };
+
+    struct ThreadInfo {
+        uint32_t tid;
+        std::string name;
+    };
+
+    bool readVarint(uint64_t& v);
+    bool readString(std::string& str);
+    std::shared_ptr<Logger> getLogger(const std::string& name);
+private:
+    std::ifstream m_in;
+    bool m_error = false;
+    //deque不会移动已有元素, LogEvent可以直接引用Site::file
+    std::deque<Site> m_sites;
+    std::vector<ThreadInfo> m_threads;
+    std::unordered_map<std::string, std::shared_ptr<Logger> > m_loggers;
+    std::string m_content;
 };
 
 class LoggerManager{
@@ -0,0 +1,142 @@
+#include "numa.h"
+#include "config.h"
+#include "log.h"
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace server {
+
+static Logger::ptr g_logger = SERVER_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_numa_simulate_nodes =
+    Config::Lookup<uint32_t>("numa.simulate_nodes", 0, "split online cpus into this many simulated numa nodes, 0 uses the real topology");
+
+//与<numaif.h>中MPOL_PREFERRED一致, 避免依赖libnuma
+static const int s_mpol_preferred = 1;
+
+static thread_local int t_numa_node = -1;
+
+//解析"0-3,8,10-11"格式的cpu列表
+static std::vector<int> ParseCpuList(const std::string& str) {
+    std::vector<int> cpus;
+    std::stringstream ss(str);
+    std::string item;
+    while(std::getline(ss, item, ',')) {
+        if(item.empty()) {
+            continue;
+        }
+        size_t pos = item.find('-');
+        int begin = atoi(item.c_str());
+        int end = pos == std::string::npos ? begin : atoi(item.c_str() + pos + 1);
+        for(int i = begin; i <= end; ++i) {
+            cpus.push_back(i);
+        }
+    }
+    return cpus;
+}
+
+NumaTopology::NumaTopology() {
+    uint32_t simulate = g_numa_simulate_nodes->getValue();
+    if(!simulate) {
+        for(int node = 0; ; ++node) {
+            std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if(!ifs) {
+                break;
+            }
+            std::string line;
+            std::getline(ifs, line);
+            m_nodeCpus.push_back(ParseCpuList(line));
+        }
+    }
+    if(m_nodeCpus.empty()) {
+        //没有NUMA信息时视为单节点
+        m_simulated = simulate > 0;
+        m_nodeCpus.resize(simulate ? simulate : 1);
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        for(long i = 0; i < ncpu; ++i) {
+            m_nodeCpus[i % m_nodeCpus.size()].push_back(i);
+        }
+    }
+
+    for(size_t node = 0; node < m_nodeCpus.size(); ++node) {
+        for(int cpu : m_nodeCpus[node]) {
+            if(cpu >= (int)m_cpuNode.size()) {
+                m_cpuNode.resize(cpu + 1, -1);
+            }
+            m_cpuNode[cpu] = node;
+        }
+    }
+    SERVER_LOG_INFO(g_logger) << "numa topology: " << toString();
+}
+
+const std::vector<int>& NumaTopology::getNodeCpus(int node) const {
+    static const std::vector<int> s_empty;
+    if(node < 0 || node >= (int)m_nodeCpus.size()) {
+        return s_empty;
+    }
+    return m_nodeCpus[node];
+}
+
+int NumaTopology::getCpuNode(int cpu) const {
+    if(cpu < 0 || cpu >= (int)m_cpuNode.size()) {
+        return -1;
+    }
+    return m_cpuNode[cpu];
+}
+
+std::string NumaTopology::toString() const {
+    std::stringstream ss;
+    ss << (m_simulated ? "simulated " : "") << m_nodeCpus.size() << " node(s)";
+    for(size_t i = 0; i < m_nodeCpus.size(); ++i) {
+        ss << " node" << i << "=[";
+        for(size_t j = 0; j < m_nodeCpus[i].size(); ++j) {
+            ss << (j ? "," : "") << m_nodeCpus[i][j];
+        }
+        ss << "]";
+    }
+    return ss.str();
+}
+
+bool NumaTopology::useMbind(int node) const {
+    return !m_simulated && m_nodeCpus.size() > 1
+        && node >= 0 && node < (int)m_nodeCpus.size() && node < (int)(sizeof(unsigned long) * 8);
+}
+
+void* NumaTopology::alloc(size_t size, int node) {
+    if(!useMbind(node)) {
+        return malloc(size);
+    }
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ptr == MAP_FAILED) {
+        SERVER_LOG_ERROR(g_logger) << "mmap size=" << size << " errno=" << errno;
+        return nullptr;
+    }
+    unsigned long mask = 1ul << node;
+    if(syscall(SYS_mbind, ptr, size, s_mpol_preferred, &mask, sizeof(mask) * 8, 0)) {
+        //绑定失败不影响使用, 退化为首次访问分配
+        SERVER_LOG_DEBUG(g_logger) << "mbind node=" << node << " errno=" << errno;
+    }
+    return ptr;
+}
+
+void NumaTopology::dealloc(void* ptr, size_t size, int node) {
+    if(!useMbind(node)) {
+        free(ptr);
+        return;
+    }
+    munmap(ptr, size);
+}
+
+int NumaTopology::GetCurrentNode() {
+    return t_numa_node;
+}
+
+void NumaTopology::SetCurrentNode(int node) {
+    t_numa_node = node;
+}
+
+}
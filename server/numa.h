@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <string>
+#include "singleton.h"
+
+namespace server {
+
+//CPU/NUMA拓扑, 首次使用时从/sys/devices/system/node读取
+//配置numa.simulate_nodes > 0时把在线CPU按序号轮流分到模拟节点上, 用于单节点机器上测试
+class NumaTopology {
+public:
+    NumaTopology();
+
+    size_t getNodeCount() const { return m_nodeCpus.size(); }
+    const std::vector<int>& getNodeCpus(int node) const;
+    //cpu所属节点, 未知返回-1
+    int getCpuNode(int cpu) const;
+    bool isSimulated() const { return m_simulated; }
+
+    std::string toString() const;
+
+    //在node上分配内存(mmap + mbind首选该节点), 模拟拓扑或单节点时使用malloc
+    void* alloc(size_t size, int node);
+    void dealloc(void* ptr, size_t size, int node);
+
+    //当前线程所在节点, 未绑定返回-1
+    static int GetCurrentNode();
+    static void SetCurrentNode(int node);
+private:
+    bool useMbind(int node) const;
+private:
+    bool m_simulated = false;
+    std::vector<std::vector<int> > m_nodeCpus;
+    std::vector<int> m_cpuNode;
+};
+
+typedef Singleton<NumaTopology> NumaMgr;
+
+}
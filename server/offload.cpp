@@ -0,0 +1,101 @@
+#include "offload.h"
+#include "scheduler.h"
+#include "config.h"
+#include "hook.h"
+#include "log.h"
+
+namespace server {
+
+static Logger::ptr g_logger = SERVER_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_offload_threads =
+    Config::Lookup<uint32_t>("offload.threads", 4, "threads running blocking calls offloaded from fibers");
+
+OffloadPool::OffloadPool(size_t threads, const std::string& name)
+    : m_threadCount(threads ? threads : g_offload_threads->getValue())
+    , m_name(name) {
+    if(!m_threadCount) {
+        m_threadCount = 1;
+    }
+}
+
+OffloadPool::~OffloadPool() {
+    {
+        MutexType::Lock lock(m_mutex);
+        m_stopping = true;
+    }
+    for(size_t i = 0; i < m_threads.size(); ++i) {
+        m_sem.notify();
+    }
+    for(auto& i : m_threads) {
+        i->join();
+    }
+}
+
+void OffloadPool::start() {
+    //调用方持有m_mutex, 第一次offload时才创建线程
+    for(size_t i = 0; i < m_threadCount; ++i) {
+        m_threads.push_back(Thread::ptr(new Thread(std::bind(&OffloadPool::run, this),
+                            m_name + "_" + std::to_string(i))));
+    }
+}
+
+void OffloadPool::offload(Callback cb) {
+    Scheduler* scheduler = Scheduler::GetThis();
+    Fiber* cur = Fiber::GetThisRaw();
+    if(!scheduler || !is_hook_enable() || cur == Scheduler::GetMainFiber()) {
+        cb();
+        return;
+    }
+
+    Task task;
+    task.cb = std::move(cb);
+    task.fiber = cur->shared_from_this();
+    task.scheduler = scheduler;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_threads.empty()) {
+            start();
+        }
+        m_tasks.push_back(&task);
+    }
+    scheduler->addExternalWait();
+    ++m_offloadCount;
+    m_sem.notify();
+    //完成前可能已被重新调度, 调度器会等本协程切出后再执行它
+    Fiber::YieldToHold();
+    if(task.exception) {
+        std::rethrow_exception(task.exception);
+    }
+}
+
+void OffloadPool::run() {
+    while(true) {
+        m_sem.wait();
+        Task* task = nullptr;
+        {
+            MutexType::Lock lock(m_mutex);
+            if(m_tasks.empty()) {
+                if(m_stopping) {
+                    break;
+                }
+                continue;
+            }
+            task = m_tasks.front();
+            m_tasks.pop_front();
+        }
+        try {
+            task->cb();
+        } catch (...) {
+            task->exception = std::current_exception();
+        }
+        //task位于挂起协程的栈上, schedule之后不能再访问
+        Fiber::ptr fiber;
+        fiber.swap(task->fiber);
+        Scheduler* scheduler = task->scheduler;
+        scheduler->schedule(std::move(fiber));
+        scheduler->delExternalWait();
+    }
+}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <deque>
+#include <vector>
+#include <exception>
+#include "thread.h"
+#include "fiber.h"
+#include "singleton.h"
+
+namespace server {
+
+class Scheduler;
+
+//阻塞调用线程池: 普通文件IO等无法用epoll等待的阻塞调用放到这里执行, 调用协程挂起直到完成
+class OffloadPool : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    //threads为0时使用配置offload.threads
+    OffloadPool(size_t threads = 0, const std::string& name = "offload");
+    ~OffloadPool();
+
+    //在线程池中执行cb, 当前协程挂起, 完成后在原调度器上恢复; cb抛出的异常在调用协程中重新抛出
+    //不在hook开启的调度线程中时直接在当前线程执行
+    void offload(Callback cb);
+
+    size_t getThreadCount() const { return m_threadCount; }
+    //累计交给线程池执行的调用数
+    uint64_t getOffloadCount() const { return m_offloadCount; }
+private:
+    struct Task {
+        Callback cb;
+        Fiber::ptr fiber;
+        Scheduler* scheduler = nullptr;
+        std::exception_ptr exception;
+    };
+
+    void start();
+    void run();
+private:
+    MutexType m_mutex;
+    Semaphore m_sem;
+    std::deque<Task*> m_tasks;
+    std::vector<Thread::ptr> m_threads;
+    size_t m_threadCount;
+    std::string m_name;
+    bool m_stopping = false;
+    std::atomic<uint64_t> m_offloadCount = {0};
+};
+
+typedef Singleton<OffloadPool> OffloadMgr;
+
+}
@@ -2,13 +2,69 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "config.h"
+#include <execinfo.h>
+#include <signal.h>
 
 namespace server {
 
 static server::Logger::ptr g_logger = SERVER_LOG_NAME("system");
 
+static ConfigVar<uint32_t>::ptr g_fiber_pool_size = 
+    Config::Lookup<uint32_t>("fiber.pool_size", 64, "max terminated fibers cached per scheduler thread");
+
+static ConfigVar<uint32_t>::ptr g_priority_max_wait = 
+    Config::Lookup<uint32_t>("scheduler.priority.max_wait_ms", 100, "low priority task waiting longer than this runs first");
+
+static ConfigVar<uint32_t>::ptr g_watchdog_budget = 
+    Config::Lookup<uint32_t>("scheduler.watchdog.budget_ms", 0, "fiber running longer than this is reported and asked to yield, 0 disables");
+
+static ConfigVar<bool>::ptr g_watchdog_signal_stack = 
+    Config::Lookup<bool>("scheduler.watchdog.signal_stack", false, "signal a stuck worker to capture its stack, may interrupt its blocking syscalls with EINTR");
+
+static ConfigVar<bool>::ptr g_elastic_enable = 
+    Config::Lookup<bool>("scheduler.elastic.enable", false, "grow and shrink worker threads with load");
+
+static ConfigVar<uint32_t>::ptr g_elastic_min_threads = 
+    Config::Lookup<uint32_t>("scheduler.elastic.min_threads", 0, "elastic lower bound, 0 uses the constructor thread count");
+
+static ConfigVar<uint32_t>::ptr g_elastic_max_threads = 
+    Config::Lookup<uint32_t>("scheduler.elastic.max_threads", 0, "elastic upper bound, 0 disables growth");
+
+static ConfigVar<uint32_t>::ptr g_elastic_scale_up_wait = 
+    Config::Lookup<uint32_t>("scheduler.elastic.scale_up_wait_ms", 10, "add a worker when a task waited longer than this and no worker is idle");
+
+static ConfigVar<uint32_t>::ptr g_elastic_idle_cooldown = 
+    Config::Lookup<uint32_t>("scheduler.elastic.idle_cooldown_ms", 5000, "retire a worker idle longer than this");
+
+static ConfigVar<bool>::ptr g_affinity_enable = 
+    Config::Lookup<bool>("scheduler.affinity.enable", false, "pin worker threads to cpus / numa nodes");
+
+static ConfigVar<std::vector<int> >::ptr g_affinity_cpus = 
+    Config::Lookup<std::vector<int> >("scheduler.affinity.cpus", std::vector<int>(), "cpus assigned to workers in turn, empty pins each worker to a whole numa node");
+
+//同节点任务只在队列前部这么多个任务内查找, 避免远端任务等待过久
+static const size_t s_numa_scan_window = 8;
+
+//配置监听在修改配置的线程中写, 各工作线程读
+static std::atomic<uint64_t> s_priority_max_wait_us = {0};
+struct _SchedulerIniter {
+    _SchedulerIniter() {
+        s_priority_max_wait_us.store(g_priority_max_wait->getValue() * 1000ull, std::memory_order_relaxed);
+        g_priority_max_wait->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            s_priority_max_wait_us.store(new_value * 1000ull, std::memory_order_relaxed);
+        });
+    }
+};
+
+static _SchedulerIniter s_scheduler_initer;
+
 static thread_local Scheduler* t_scheduler = nullptr;   //当前正在执行的协程调度器
 static thread_local Fiber* t_fiber = nullptr;   //run主协程
+static thread_local std::atomic<bool>* t_over_budget = nullptr;    //本线程watchdog超时标记
+static thread_local WatchdogTrace* t_watchdog_trace = nullptr;     //本线程调用栈记录位置
+static thread_local uint64_t t_watchdog_signals = 0;    //本线程收到的取栈信号数
+static thread_local uint64_t t_idle_since_us = 0;  //本线程开始空闲的时间, 0表示正在执行任务
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name) : m_name(name) {
     SERVER_ASSERT(threads > 0);
@@ -47,6 +103,18 @@ Fiber* Scheduler::GetMainFiber() {
     return t_fiber;
 }
 
+bool Scheduler::IsOverBudget() {
+    return t_over_budget && t_over_budget->load(std::memory_order_relaxed);
+}
+
+bool Scheduler::TakeStackRequest() {
+    return t_watchdog_trace && t_watchdog_trace->wanted.exchange(false, std::memory_order_relaxed);
+}
+
+uint64_t Scheduler::GetWatchdogSignals() {
+    return t_watchdog_signals;
+}
+
 void Scheduler::start() {
     MutexType::Lock lock(m_mutex);
     if(!m_stopping) {
@@ -55,12 +123,34 @@ void Scheduler::start() {
     m_stopping = false;
     SERVER_ASSERT(m_threads.empty());
 
+    m_affinity = g_affinity_enable->getValue();
+    m_affinityCpus = g_affinity_cpus->getValue();
+    m_elastic = g_elastic_enable->getValue();
+    if(m_elastic) {
+        m_minThreads = g_elastic_min_threads->getValue();
+        if(!m_minThreads || m_minThreads > m_threadCount) {
+            m_minThreads = m_threadCount;
+        }
+        m_maxThreads = std::max<size_t>(g_elastic_max_threads->getValue(), m_threadCount);
+        m_scaleUpWaitUs = g_elastic_scale_up_wait->getValue() * 1000ull;
+        m_idleCooldownUs = g_elastic_idle_cooldown->getValue() * 1000ull;
+    }
+
+    //工作线程启动时据此决定是否登记watchdog, 必须在创建线程前设置
+    m_watchdogBudgetUs = g_watchdog_budget->getValue() * 1000ull;
+    m_watchdogSignalStack = g_watchdog_signal_stack->getValue();
+
     m_threads.resize(m_threadCount);
     for(size_t i = 0; i < m_threadCount; ++i) {
         m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), 
-                            m_name + "_" + std::to_string(i)));
+                            m_name + "_" + std::to_string(m_nextThreadIndex++)));
         m_threadIds.push_back(m_threads[i]->getId());
     }
+    //弹性模式也需要该线程: 所有工作线程都卡在长任务中时没有线程取任务, 由它发现积压并扩容
+    if(m_watchdogBudgetUs || m_elastic) {
+        m_watchdogStop = false;
+        m_watchdog.reset(new Thread(std::bind(&Scheduler::watchdog, this), m_name + "_watchdog"));
+    }
     lock.unlock();
 
     // if(m_rootFiber) {
@@ -118,10 +208,18 @@ void Scheduler::stop() {
     {
         MutexType::Lock lock(m_mutex);
         thrs.swap(m_threads);
+        thrs.insert(thrs.end(), m_retiredThreads.begin(), m_retiredThreads.end());
+        m_retiredThreads.clear();
     }
     for(auto& i : thrs) {
         i->join();
     }
+
+    if(m_watchdog) {
+        m_watchdogStop = true;
+        m_watchdog->join();
+        m_watchdog.reset();
+    }
  
     // if(exit_on_this_fiber) {
     // }
@@ -136,38 +234,77 @@ void Scheduler::run() {
     set_hook_enable(true);
     setThis();
     if(server::GetThreadId() != m_rootThread) {
-        t_fiber = Fiber::GetThis().get();
+        t_fiber = Fiber::GetThisRaw();
     }
 
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
     Fiber::ptr cb_fiber;
+    //本线程已结束、可复用的协程
+    std::vector<Fiber::ptr> fiber_pool;
+    size_t pool_size = g_fiber_pool_size->getValue();
+    fiber_pool.reserve(pool_size);
+    //回调协程使用默认栈大小，与idle协程一致
+    uint32_t cb_stack_size = idle_fiber->getStackSize();
+    int thread_id = server::GetThreadId();
+    if(m_affinity && thread_id != m_rootThread) {
+        bindWorker();
+    }
+    int node = NumaTopology::GetCurrentNode();
+    WatchdogSlot::ptr slot;
+    if(m_watchdogBudgetUs) {
+        slot.reset(new WatchdogSlot);
+        slot->threadId = thread_id;
+        slot->pthread = pthread_self();
+        t_over_budget = &slot->overBudget;
+        t_watchdog_trace = &slot->trace;
+        MutexType::Lock lock(m_mutex);
+        m_watchdogSlots.push_back(slot);
+    }
 
     FiberAndThread ft;
     while(true) {
         ft.reset();
         bool tickle_me = false;
         bool is_active = false;
+        bool scale_up = false;
         {
             MutexType::Lock lock(m_mutex);
-            auto it = m_fibers.begin();
-            while(it != m_fibers.end()) {
-                if(it->thread != -1 && it->thread != server::GetThreadId()) {
-                    ++it;
-                    tickle_me = true;
-                    continue;
+            //低优先级队列头部等待超过max_wait时先服务它, 防止饿死
+            uint64_t now_us = GetCurrentUS();
+            uint64_t max_wait_us = s_priority_max_wait_us.load(std::memory_order_relaxed);
+            int starved = -1;
+            for(int p = Fiber::PRIORITY_NUM - 1; p > 0; --p) {
+                if(!m_fibers[p].empty() && now_us - m_fibers[p].front().enqueueUs > max_wait_us) {
+                    starved = p;
+                    break;
                 }
-
-                SERVER_ASSERT(it->fiber || it->cb);
-                if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                    ++it;
-                    continue;
+            }
+            if(starved >= 0) {
+                is_active = takeTaskNoLock(m_fibers[starved], thread_id, node, ft, tickle_me);
+            }
+            for(int p = 0; !is_active && p < Fiber::PRIORITY_NUM; ++p) {
+                if(p != starved) {
+                    is_active = takeTaskNoLock(m_fibers[p], thread_id, node, ft, tickle_me);
+                }
+            }
+            if(is_active) {
+                PriorityStats& stats = m_priorityStats[ft.priority];
+                uint64_t wait_us = now_us > ft.enqueueUs ? now_us - ft.enqueueUs : 0;
+                ++stats.dequeued;
+                stats.totalWaitUs += wait_us;
+                if(wait_us > stats.maxWaitUs) {
+                    stats.maxWaitUs = wait_us;
                 }
-
-                ft = *it;
-                m_fibers.erase(it);
                 ++m_activeThreadCount;
-                is_active = true;
-                break;
+                if(node >= 0 && ft.node >= 0) {
+                    if(ft.node == node) {
+                        ++m_nodeLocalRuns;
+                    }
+                    else {
+                        ++m_nodeRemoteRuns;
+                    }
+                }
+                scale_up = m_elastic && wait_us > m_scaleUpWaitUs && shouldScaleUpNoLock(now_us);
             }
         }
 
@@ -175,8 +312,21 @@ void Scheduler::run() {
             tickle();
         }
 
+        if(scale_up) {
+            addThread();
+        }
+        if(is_active) {
+            t_idle_since_us = 0;
+        }
+
         if(ft.fiber && (ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT)) {
+            if(slot) {
+                watchdogSwapIn(slot.get(), ft.fiber.get());
+            }
             ft.fiber->swapIn();
+            if(slot) {
+                watchdogSwapOut(slot.get());
+            }
             --m_activeThreadCount;
 
             if(ft.fiber->getState() == Fiber::READY) {
@@ -185,29 +335,49 @@ void Scheduler::run() {
             else if(ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT) {
                 ft.fiber->m_state = Fiber::HOLD;
             }
+            else if(ft.fiber.use_count() == 1 && ft.fiber->getStackSize() == cb_stack_size
+                    && fiber_pool.size() < pool_size) {
+                //挂起后在本线程结束的回调协程，没有其他持有者，回收复用
+                ft.fiber->reset(nullptr);
+                fiber_pool.push_back(ft.fiber);
+            }
             ft.reset();
         }
         else if(ft.cb) {
-            if(cb_fiber) {
-                cb_fiber->reset(ft.cb);
+            if(!fiber_pool.empty()) {
+                cb_fiber.swap(fiber_pool.back());
+                fiber_pool.pop_back();
+                cb_fiber->reset(std::move(ft.cb));
+                ++m_fiberPoolHits;
             }
             else {
-                cb_fiber.reset(new Fiber(ft.cb));
+                cb_fiber.reset(new Fiber(std::move(ft.cb)));
+                ++m_fiberPoolMisses;
             }
+            cb_fiber->m_priority = ft.priority;
             ft.reset();
+            if(slot) {
+                watchdogSwapIn(slot.get(), cb_fiber.get());
+            }
             cb_fiber->swapIn();
+            if(slot) {
+                watchdogSwapOut(slot.get());
+            }
             --m_activeThreadCount;
             if(cb_fiber->getState() == Fiber::READY) {
                 schedule(cb_fiber);
-                cb_fiber.reset();
             }
             else if(cb_fiber->getState() == Fiber::EXCEPT || cb_fiber->getState() == Fiber::TERM) {
-                cb_fiber->reset(nullptr);
+                //还有其他持有者(如cancel用的句柄)时不回收, 以免指向被复用的协程
+                if(cb_fiber.use_count() == 1 && fiber_pool.size() < pool_size) {
+                    cb_fiber->reset(nullptr);
+                    fiber_pool.push_back(cb_fiber);
+                }
             }
             else {
                 cb_fiber->m_state = Fiber::HOLD;
-                cb_fiber.reset();
             }
+            cb_fiber.reset();
         }
         else {
             if(is_active) {
@@ -216,9 +386,23 @@ void Scheduler::run() {
             }
             if(idle_fiber->getState() == Fiber::TERM) {
                 SERVER_LOG_INFO(g_logger) << "idle fiber term";
+                if(slot) {
+                    MutexType::Lock lock(m_mutex);
+                    for(auto it = m_watchdogSlots.begin(); it != m_watchdogSlots.end(); ++it) {
+                        if(*it == slot) {
+                            m_watchdogSlots.erase(it);
+                            break;
+                        }
+                    }
+                    t_over_budget = nullptr;
+                    t_watchdog_trace = nullptr;
+                }
                 break;
             }
 
+            if(m_elastic && !t_idle_since_us) {
+                t_idle_since_us = GetCurrentUS();
+            }
             ++m_idleThreadCount;
             idle_fiber->swapIn();
             --m_idleThreadCount;
@@ -230,16 +414,329 @@ void Scheduler::run() {
     }
 }
 
+void Scheduler::addThread() {
+    std::vector<Thread::ptr> retired;
+    {
+        MutexType::Lock lock(m_mutex);
+        retired.swap(m_retiredThreads);
+        if(m_stopping || m_threadCount >= m_maxThreads) {
+            m_retiredThreads.swap(retired);
+            return;
+        }
+        Thread::ptr thr(new Thread(std::bind(&Scheduler::run, this),
+                            m_name + "_" + std::to_string(m_nextThreadIndex++)));
+        m_threads.push_back(thr);
+        m_threadIds.push_back(thr->getId());
+        ++m_threadCount;
+        SERVER_LOG_INFO(g_logger) << m_name << " scale up, threads=" << m_threadCount;
+    }
+    //回收已退出的线程
+    for(auto& i : retired) {
+        i->join();
+    }
+}
+
+bool Scheduler::canRetire() {
+    if(!m_elastic || !t_idle_since_us || server::GetThreadId() == m_rootThread
+            || GetCurrentUS() - t_idle_since_us < m_idleCooldownUs) {
+        return false;
+    }
+    MutexType::Lock lock(m_mutex);
+    if(m_stopping || m_threadCount <= m_minThreads || hasTasksNoLock()) {
+        return false;
+    }
+    Thread* self = Thread::GetThis();
+    for(auto it = m_threads.begin(); it != m_threads.end(); ++it) {
+        if(it->get() == self) {
+            m_retiredThreads.push_back(*it);
+            m_threads.erase(it);
+            break;
+        }
+    }
+    int thread_id = server::GetThreadId();
+    for(auto it = m_threadIds.begin(); it != m_threadIds.end(); ++it) {
+        if(*it == thread_id) {
+            m_threadIds.erase(it);
+            break;
+        }
+    }
+    --m_threadCount;
+    t_idle_since_us = 0;
+    SERVER_LOG_INFO(g_logger) << m_name << " retire idle thread, threads=" << m_threadCount;
+    return true;
+}
+
+uint64_t Scheduler::getRetireCheckMs() const {
+    return m_elastic ? std::max<uint64_t>(m_idleCooldownUs / 1000, 1) : ~0ull;
+}
+
+void Scheduler::watchdogSwapIn(WatchdogSlot* slot, Fiber* fiber) {
+    slot->overBudget.store(false, std::memory_order_relaxed);
+    slot->trace.wanted.store(false, std::memory_order_relaxed);
+    uintptr_t stack = (uintptr_t)fiber->getStack();
+    slot->trace.stackLo.store(stack, std::memory_order_relaxed);
+    slot->trace.stackHi.store(stack ? stack + fiber->getStackSize() : 0, std::memory_order_relaxed);
+    slot->startUs.store(GetCurrentUS(), std::memory_order_relaxed);
+    slot->fiberId.store(fiber->getId(), std::memory_order_release);
+}
+
+void Scheduler::watchdogSwapOut(WatchdogSlot* slot) {
+    slot->fiberId.store(0, std::memory_order_release);
+    slot->overBudget.store(false, std::memory_order_relaxed);
+    slot->trace.wanted.store(false, std::memory_order_relaxed);
+}
+
+bool Scheduler::shouldScaleUpNoLock(uint64_t now_us) {
+    //没有空闲线程时每个等待阈值周期最多扩容一个线程
+    if(m_idleThreadCount != 0 || m_stopping || m_threadCount >= m_maxThreads
+            || now_us - m_lastScaleUpUs <= m_scaleUpWaitUs) {
+        return false;
+    }
+    m_lastScaleUpUs = now_us;
+    return true;
+}
+
+void Scheduler::watchdog() {
+    //检查间隔取预算的一半, 超时最迟在1.5倍预算内被发现; 弹性模式同样取扩容等待阈值的一半
+    uint64_t interval_us = ~0ull;
+    if(m_watchdogBudgetUs) {
+        interval_us = m_watchdogBudgetUs / 2;
+    }
+    if(m_elastic) {
+        interval_us = std::min(interval_us, m_scaleUpWaitUs / 2);
+    }
+    interval_us = std::max<uint64_t>(interval_us, 1000);
+    std::vector<WatchdogSlot::ptr> slots;
+    while(!m_watchdogStop) {
+        usleep(interval_us);
+        if(m_elastic) {
+            bool scale_up = false;
+            {
+                MutexType::Lock lock(m_mutex);
+                uint64_t now_us = GetCurrentUS();
+                uint64_t oldest_us = now_us;
+                for(auto& q : m_fibers) {
+                    if(!q.empty() && q.front().enqueueUs < oldest_us) {
+                        oldest_us = q.front().enqueueUs;
+                    }
+                }
+                scale_up = now_us - oldest_us > m_scaleUpWaitUs && shouldScaleUpNoLock(now_us);
+            }
+            if(scale_up) {
+                addThread();
+            }
+        }
+        if(!m_watchdogBudgetUs) {
+            continue;
+        }
+        {
+            MutexType::Lock lock(m_mutex);
+            slots = m_watchdogSlots;
+        }
+        uint64_t now_us = GetCurrentUS();
+        for(auto& i : slots) {
+            uint64_t fiber_id = i->fiberId.load(std::memory_order_acquire);
+            uint64_t start_us = i->startUs.load(std::memory_order_relaxed);
+            if(!fiber_id || i->overBudget.load(std::memory_order_relaxed)
+                    || now_us < start_us || now_us - start_us <= m_watchdogBudgetUs) {
+                continue;
+            }
+            std::string stack;
+            if(m_watchdogSignalStack) {
+                stack = watchdogCapture(i, fiber_id);
+            }
+            if(stack.empty()) {
+                i->trace.wanted.store(true, std::memory_order_relaxed);
+            }
+            i->overBudget.store(true, std::memory_order_relaxed);
+            SERVER_LOG_WARN(g_logger) << "watchdog: fiber_id=" << fiber_id
+                << " running " << (now_us - start_us) / 1000 << "ms without yielding"
+                << " thread=" << i->threadId << " scheduler=" << m_name << std::endl
+                << (stack.empty() ? "    <stack is logged when the fiber reaches a checkpoint>\n" : stack);
+        }
+    }
+}
+
+//在被watchdog打断的线程上执行, 必须是异步信号安全的: backtrace可能加锁或分配内存, 不能使用
+//从被打断处的指令和帧指针开始, 只读取协程栈范围内的内存回溯; 省略帧指针编译的代码回溯会提前结束
+static void OnWatchdogSignal(int signo, siginfo_t* info, void* context) {
+    ++t_watchdog_signals;
+    WatchdogTrace* trace = t_watchdog_trace;
+    if(!trace) {
+        return;
+    }
+    int depth = 0;
+#if defined(__x86_64__)
+    const ucontext_t* uc = (const ucontext_t*)context;
+    uintptr_t lo = trace->stackLo.load(std::memory_order_relaxed);
+    uintptr_t hi = trace->stackHi.load(std::memory_order_relaxed);
+    trace->frames[depth++] = (void*)uc->uc_mcontext.gregs[REG_RIP];
+    uintptr_t fp = uc->uc_mcontext.gregs[REG_RBP];
+    while(depth < WatchdogTrace::MAX_DEPTH && fp >= lo && fp + 2 * sizeof(uintptr_t) <= hi
+            && !(fp & (sizeof(uintptr_t) - 1))) {
+        const uintptr_t* frame = (const uintptr_t*)fp;
+        if(!frame[1]) {
+            break;
+        }
+        trace->frames[depth++] = (void*)frame[1];
+        //栈向低地址增长, 上一帧一定在更高的地址
+        if(frame[0] <= fp) {
+            break;
+        }
+        fp = frame[0];
+    }
+#endif
+    trace->depth.store(depth, std::memory_order_release);
+}
+
+static int InstallWatchdogSignal() {
+    int signo = SIGRTMIN + 2;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = &OnWatchdogSignal;
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(signo, &sa, nullptr)) {
+        SERVER_LOG_ERROR(g_logger) << "watchdog sigaction(" << signo << ") errno=" << errno
+            << " errstr=" << strerror(errno);
+        return 0;
+    }
+    return signo;
+}
+
+std::string Scheduler::watchdogCapture(const WatchdogSlot::ptr& slot, uint64_t fiber_id) {
+    static int s_signo = InstallWatchdogSignal();
+    if(!s_signo) {
+        return "";
+    }
+    slot->trace.depth.store(-1, std::memory_order_relaxed);
+    {
+        //线程退出前会从m_watchdogSlots中移除, 仍在其中说明线程还活着
+        MutexType::Lock lock(m_mutex);
+        if(std::find(m_watchdogSlots.begin(), m_watchdogSlots.end(), slot) == m_watchdogSlots.end()
+                || pthread_kill(slot->pthread, s_signo)) {
+            return "";
+        }
+    }
+    int depth = -1;
+    for(int i = 0; i < 100; ++i) {
+        depth = slot->trace.depth.load(std::memory_order_acquire);
+        if(depth >= 0) {
+            break;
+        }
+        usleep(1000);
+    }
+    //记录时协程已经让出, 栈不是它的
+    if(depth <= 0 || slot->fiberId.load(std::memory_order_acquire) != fiber_id) {
+        return "";
+    }
+    char** strings = backtrace_symbols(slot->trace.frames, depth);
+    if(!strings) {
+        return "";
+    }
+    std::stringstream ss;
+    for(int i = 0; i < depth; ++i) {
+        ss << "    " << strings[i] << std::endl;
+    }
+    free(strings);
+    return ss.str();
+}
+
+bool Scheduler::takeTaskNoLock(std::deque<FiberAndThread>& queue, int thread_id, int node, FiberAndThread& ft, bool& tickle_me) {
+    auto it = queue.begin();
+    auto first = queue.end();   //第一个可执行但不在本节点的任务
+    size_t scanned = 0;
+    while(it != queue.end()) {
+        if(first != queue.end() && ++scanned > s_numa_scan_window) {
+            break;
+        }
+        if(it->thread != -1 && it->thread != thread_id) {
+            ++it;
+            tickle_me = true;
+            continue;
+        }
+
+        SERVER_ASSERT(it->fiber || it->cb);
+        if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
+            ++it;
+            continue;
+        }
+
+        if(node >= 0 && it->node >= 0 && it->node != node) {
+            if(first == queue.end()) {
+                first = it;
+            }
+            ++it;
+            continue;
+        }
+        first = it;
+        break;
+    }
+    if(first == queue.end()) {
+        return false;
+    }
+    ft = std::move(*first);
+    queue.erase(first);
+    return true;
+}
+
+void Scheduler::bindWorker() {
+    size_t seq = m_workerSeq++;
+    NumaTopology* topo = NumaMgr::GetInstance();
+    int node = -1;
+    std::vector<int> cpus;
+    if(!m_affinityCpus.empty()) {
+        int cpu = m_affinityCpus[seq % m_affinityCpus.size()];
+        cpus.push_back(cpu);
+        node = topo->getCpuNode(cpu);
+    }
+    else {
+        node = seq % topo->getNodeCount();
+        cpus = topo->getNodeCpus(node);
+    }
+    //模拟拓扑中节点可能没有cpu, 只记录节点
+    if(!cpus.empty()) {
+        Thread::SetAffinity(cpus);
+    }
+    NumaTopology::SetCurrentNode(node);
+    SERVER_LOG_INFO(g_logger) << m_name << " worker " << seq << " bind node=" << node
+        << " cpus=" << cpus.size();
+}
+
+bool Scheduler::hasTasksNoLock() const {
+    for(int i = 0; i < Fiber::PRIORITY_NUM; ++i) {
+        if(!m_fibers[i].empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Scheduler::PriorityStats Scheduler::getPriorityStats(Fiber::Priority priority) {
+    MutexType::Lock lock(m_mutex);
+    PriorityStats stats = m_priorityStats[priority];
+    stats.depth = m_fibers[priority].size();
+    return stats;
+}
+
+void Scheduler::delExternalWait() {
+    //正在停止时唤醒空闲线程重新检查stopping
+    if(--m_externalWaits == 0 && m_stopping) {
+        tickle();
+    }
+}
+
 void Scheduler::tickle() {
     SERVER_LOG_INFO(g_logger) << "tickle";
 }
 bool Scheduler::stopping() {
     MutexType::Lock lock(m_mutex);
-    return m_autoStop && m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+    return m_autoStop && m_stopping && !hasTasksNoLock() && m_activeThreadCount == 0
+        && m_externalWaits == 0;
 }
 void Scheduler::idle() {
     SERVER_LOG_INFO(g_logger) << "idle";
-    while(!stopping()) {
+    while(!stopping() && !canRetire()) {
         server::Fiber::YieldToHold();
     }
 }
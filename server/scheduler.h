@@ -2,34 +2,78 @@
 
 #include <iostream>
 #include <memory>
-#include <list>
+#include <deque>
 #include <vector>
 #include "fiber.h"
 #include "thread.h"
+#include "util.h"
+#include "numa.h"
 
 namespace server {
+//超时协程的调用栈记录
+//默认由协程在下一个检查点(Fiber::MaybeYield)自行记录; 开启scheduler.watchdog.signal_stack时
+//watchdog向该线程发信号, 信号处理函数沿帧指针在协程栈内回溯
+struct WatchdogTrace {
+    static const int MAX_DEPTH = 64;
+    std::atomic<int> depth = {-1};      //-1表示还没有记录
+    void* frames[MAX_DEPTH];
+    std::atomic<uintptr_t> stackLo = {0};   //正在执行的协程栈范围, 回溯不读取范围外的内存
+    std::atomic<uintptr_t> stackHi = {0};
+    std::atomic<bool> wanted = {false};     //watchdog请求协程在检查点记录自己的调用栈
+};
+
 class Scheduler {
 public:
     typedef std::shared_ptr<Scheduler> ptr;
     typedef Mutex MutexType;
 
+    //单个优先级队列的统计
+    struct PriorityStats {
+        size_t depth = 0;           //当前排队任务数
+        uint64_t dequeued = 0;      //累计出队任务数
+        uint64_t totalWaitUs = 0;   //累计排队时间
+        uint64_t maxWaitUs = 0;     //最大排队时间
+    };
+
     Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name = "");
     virtual ~Scheduler();
 
     const std::string& getName() const { return m_name; }
+    //当前工作线程数(不含use_caller线程), 弹性模式下会变化
+    size_t getThreadCount() const { return m_threadCount; }
+    //回调复用已结束协程的次数
+    uint64_t getFiberPoolHits() const { return m_fiberPoolHits; }
+    //回调需要新建协程的次数
+    uint64_t getFiberPoolMisses() const { return m_fiberPoolMisses; }
+    PriorityStats getPriorityStats(Fiber::Priority priority);
+    //启用亲和性时, 在任务所属节点上执行的次数
+    uint64_t getNodeLocalRuns() const { return m_nodeLocalRuns; }
+    //启用亲和性时, 在其他节点上执行的次数
+    uint64_t getNodeRemoteRuns() const { return m_nodeRemoteRuns; }
+
+    //协程挂起等待调度器之外的事件(如OffloadPool)时计数, 不为0时调度器不会停止
+    void addExternalWait() { ++m_externalWaits; }
+    void delExternalWait();
 
     static Scheduler* GetThis();
     static Fiber* GetMainFiber();
+    //当前线程正在执行的协程是否已超出watchdog运行预算
+    static bool IsOverBudget();
+    //watchdog是否请求当前协程记录调用栈, 取出后清除请求
+    static bool TakeStackRequest();
+    //本线程被watchdog取栈信号打断的次数, 用于区分EINTR是否由它引起
+    static uint64_t GetWatchdogSignals();
 
     void start();
     void stop();
 
+    //priority < 0: 协程沿用自身优先级, 回调使用NORMAL
     template<class FiberOrCb>
-    void schedule(FiberOrCb fc, int thread = -1) {
+    void schedule(FiberOrCb fc, int thread = -1, int priority = -1) {
         bool need_tickle = false;
         {
             MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
+            need_tickle = scheduleNoLock(std::move(fc), thread, priority);
         }
 
         if(need_tickle) {
@@ -38,12 +82,12 @@ public:
     }
 
     template<class InputIterator>
-    void schedule(InputIterator begin, InputIterator end) {
+    void schedule(InputIterator begin, InputIterator end, int priority = -1) {
         bool need_tickle = false;
         {
             MutexType::Lock lock(m_mutex);
             while(begin != end) {
-                need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
+                need_tickle = scheduleNoLock(&*begin, -1, priority) || need_tickle;
                 ++begin;
             }
         }
@@ -60,29 +104,44 @@ protected:
     void setThis();
 
     bool hasIdleThreads() { return m_idleThreadCount > 0; }
+    //弹性模式下idle中调用: 本线程空闲超过冷却时间且线程数大于下限时返回true, idle应退出使线程结束
+    bool canRetire();
+    //弹性模式下空闲线程检查退出的间隔(ms), 未启用返回~0ull
+    uint64_t getRetireCheckMs() const;
 private:
     template<class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int thread) {
-        bool need_tickle = m_fibers.empty();
-        FiberAndThread ft(fc, thread);
+    bool scheduleNoLock(FiberOrCb fc, int thread, int priority) {
+        bool need_tickle = !hasTasksNoLock();
+        FiberAndThread ft(std::move(fc), thread);
         if(ft.fiber || ft.cb) {
-            m_fibers.push_back(ft);
+            if(priority < 0 || priority >= Fiber::PRIORITY_NUM) {
+                priority = ft.fiber ? ft.fiber->getPriority() : Fiber::NORMAL;
+            }
+            ft.priority = (Fiber::Priority)priority;
+            //协程优先回到栈所在节点, 回调优先在提交线程的节点执行
+            ft.node = ft.fiber ? ft.fiber->getStackNode() : NumaTopology::GetCurrentNode();
+            ft.enqueueUs = GetCurrentUS();
+            m_fibers[priority].push_back(std::move(ft));
         }
         return need_tickle;
     }
+
 private:
     struct FiberAndThread {
         Fiber::ptr fiber;
-        std::function<void()> cb;
+        Callback cb;
         int thread;
+        Fiber::Priority priority = Fiber::NORMAL;
+        uint64_t enqueueUs = 0;     //入队时间
+        int node = -1;              //偏好的NUMA节点
 
-        FiberAndThread(Fiber::ptr f, int thr) : fiber(f), thread(thr) {}
+        FiberAndThread(Fiber::ptr f, int thr) : fiber(std::move(f)), thread(thr) {}
         FiberAndThread(Fiber::ptr* f, int thr) : thread(thr) {
             fiber.swap(*f);
         }
 
-        FiberAndThread(std::function<void()> f, int thr) : cb(f), thread(thr) {}
-        FiberAndThread(std::function<void()>* f, int thr) : thread(thr) {
+        FiberAndThread(Callback f, int thr) : cb(std::move(f)), thread(thr) {}
+        FiberAndThread(Callback* f, int thr) : thread(thr) {
             cb.swap(*f);
         }
 
@@ -92,22 +151,75 @@ private:
             fiber = nullptr;
             cb = nullptr;
             thread = -1;
+            priority = Fiber::NORMAL;
+            enqueueUs = 0;
+            node = -1;
         }
     };
+
+    //每个工作线程一份, 记录正在执行的协程, 供watchdog线程检查
+    struct WatchdogSlot {
+        typedef std::shared_ptr<WatchdogSlot> ptr;
+        int threadId = 0;
+        pthread_t pthread = 0;
+        WatchdogTrace trace;
+        std::atomic<uint64_t> fiberId = {0};    //0表示当前没有执行任务协程
+        std::atomic<uint64_t> startUs = {0};    //本次swapIn的时间
+        std::atomic<bool> overBudget = {false};
+    };
+
+    //弹性模式新增一个工作线程
+    void addThread();
+    //弹性模式下任务已排队过久时调用, 需要扩容返回true并记录扩容时间
+    bool shouldScaleUpNoLock(uint64_t now_us);
+    void watchdog();
+    void watchdogSwapIn(WatchdogSlot* slot, Fiber* fiber);
+    void watchdogSwapOut(WatchdogSlot* slot);
+    //开启signal_stack时向卡住的线程发信号取其调用栈, 取不到返回空串
+    std::string watchdogCapture(const WatchdogSlot::ptr& slot, uint64_t fiber_id);
+
+    bool hasTasksNoLock() const;
+    //从队列中取出本线程可执行的任务
+    //node >= 0时在队列前部优先选择同节点任务
+    bool takeTaskNoLock(std::deque<FiberAndThread>& queue, int thread_id, int node, FiberAndThread& ft, bool& tickle_me);
+    //按配置把当前工作线程绑定到cpu/节点
+    void bindWorker();
 private:
     MutexType m_mutex;
     std::vector<Thread::ptr> m_threads;
-    std::list<FiberAndThread> m_fibers;     //计划执行的协程
+    std::vector<Thread::ptr> m_retiredThreads;      //已退出待join的弹性线程
+    std::deque<FiberAndThread> m_fibers[Fiber::PRIORITY_NUM];   //按优先级计划执行的协程
+    PriorityStats m_priorityStats[Fiber::PRIORITY_NUM];
     std::string m_name;
     Fiber::ptr m_rootFiber;     //use_caller为true时有效, 调度协程
+    Thread::ptr m_watchdog;
+    std::vector<WatchdogSlot::ptr> m_watchdogSlots;
+    uint64_t m_watchdogBudgetUs = 0;    //0表示不启用watchdog
+    bool m_watchdogSignalStack = false; //是否发信号取卡住线程的调用栈
+    std::atomic<bool> m_watchdogStop = {false};
+    bool m_elastic = false;             //是否启用弹性线程数
+    size_t m_minThreads = 0;
+    size_t m_maxThreads = 0;
+    uint64_t m_scaleUpWaitUs = 0;       //任务排队超过该时间且无空闲线程时扩容
+    uint64_t m_idleCooldownUs = 0;      //线程空闲超过该时间后退出
+    uint64_t m_lastScaleUpUs = 0;
+    size_t m_nextThreadIndex = 0;       //新线程名称序号
+    bool m_affinity = false;            //是否绑定工作线程cpu
+    std::vector<int> m_affinityCpus;    //为空时按NUMA节点轮流绑定
+    std::atomic<size_t> m_workerSeq = {0};
+    std::atomic<uint64_t> m_nodeLocalRuns = {0};
+    std::atomic<uint64_t> m_nodeRemoteRuns = {0};
 protected:
     std::vector<int> m_threadIds;
-    size_t m_threadCount = 0;
+    std::atomic<size_t> m_threadCount = {0};
     std::atomic<size_t> m_activeThreadCount = {0};
     std::atomic<size_t> m_idleThreadCount = {0};    //空闲线程数量
+    std::atomic<size_t> m_externalWaits = {0};
     bool m_stopping = true;
     bool m_autoStop = false;
     int m_rootThread = 0;
+    std::atomic<uint64_t> m_fiberPoolHits = {0};
+    std::atomic<uint64_t> m_fiberPoolMisses = {0};
 
 };
 
@@ -8,4 +8,9 @@
 #include "macro.h"
 #include "fiber.h"
 #include "scheduler.h"
-#include "iomanager.h"
\ No newline at end of file
+#include "iomanager.h"
+#include "numa.h"
+#include "offload.h"
+#include "udp_batch.h"
+#include "dns.h"
+#include "zerocopy.h"
\ No newline at end of file
@@ -18,8 +18,11 @@ Semaphore::~Semaphore() {
 }
 
 void Semaphore::wait() {
-    if(sem_wait(&m_semaphore)) {
-        throw std::logic_error("sem_wait error");
+    //被信号打断时重试, SA_RESTART对sem_wait无效
+    while(sem_wait(&m_semaphore)) {
+        if(errno != EINTR) {
+            throw std::logic_error("sem_wait error");
+        }
     }
 }
 
@@ -72,6 +75,25 @@ void Thread::SetName(const std::string& name) {
     t_thread_name = name;
 }
 
+bool Thread::SetAffinity(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : cpus) {
+        if(cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if(!CPU_COUNT(&set)) {
+        return false;
+    }
+    int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(rt) {
+        SERVER_LOG_ERROR(g_logger) << "pthread_setaffinity_np fail, rt = " << rt << " name = " << t_thread_name;
+        return false;
+    }
+    return true;
+}
+
 void* Thread::run(void* arg) {
     Thread* thread = (Thread*)arg;
     t_thread = thread;
@@ -8,6 +8,7 @@
 #include <semaphore.h>
 #include <stdint.h>
 #include <atomic>
+#include <vector>
 #include "noncopyable.h"
 
 namespace server {
@@ -239,6 +240,8 @@ public:
     static Thread* GetThis();
     static const std::string& GetName();
     static void SetName(const std::string& name); 
+    //把当前线程绑定到cpus上, 成功返回true
+    static bool SetAffinity(const std::vector<int>& cpus);
 
 private:
     Thread(const Thread&) = delete;
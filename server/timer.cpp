@@ -5,9 +5,15 @@ namespace server {
 
 static server::Logger::ptr g_logger = SERVER_LOG_NAME("system");
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager) 
-    : m_recurring(recurring), m_ms(ms), m_cb(cb), m_manager(manager) {
-    
+Timer::Timer(uint64_t ms, Callback cb, bool recurring, TimerManager* manager) 
+    : m_recurring(recurring), m_ms(ms), m_manager(manager) {
+    if(recurring) {
+        m_shared.reset(new SharedCallback);
+        m_shared->cb = std::move(cb);
+    }
+    else {
+        m_cb = std::move(cb);
+    }
     m_next = GetCurrentMS() + m_ms;
 }
 
@@ -17,8 +23,9 @@ Timer::Timer(uint64_t next) : m_next(next) {
 
 bool Timer::cancel() {
     TimerManager::RWMutexType::WriteLock wlock(m_manager->m_mutex);
-    if(m_cb) {
+    if(isActive()) {
         m_cb = nullptr;
+        m_shared.reset();
         auto it = m_manager->m_timers.find(shared_from_this());
         m_manager->m_timers.erase(it);
         return true;
@@ -28,7 +35,7 @@ bool Timer::cancel() {
 
 bool Timer::refresh() {
     TimerManager::RWMutexType::WriteLock wlock(m_manager->m_mutex);
-    if(!m_cb) {
+    if(!isActive()) {
         return false;
     }
 
@@ -47,7 +54,7 @@ bool Timer::reset(uint64_t ms, bool from_now) {
         return true;
     }
     TimerManager::RWMutexType::WriteLock wlock(m_manager->m_mutex);
-    if(!m_cb) {
+    if(!isActive()) {
         return false;
     }
 
@@ -96,22 +103,25 @@ TimerManager::~TimerManager() {
 
 }
 
-Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring) {
-    Timer::ptr timer(new Timer(ms, cb, recurring, this));
+Timer::ptr TimerManager::addTimer(uint64_t ms, Callback cb, bool recurring) {
+    Timer::ptr timer(new Timer(ms, std::move(cb), recurring, this));
     RWMutexType::WriteLock wlock(m_mutex);
     addTimer(timer, wlock);
     return timer;
 }
 
-static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
-    std::shared_ptr<void> tmp = weak_cond.lock();
-    if(tmp) {
-        cb();
+Timer::ptr TimerManager::addConditionTimer(uint64_t ms, Callback cb, std::weak_ptr<void> weak_cond, bool recurring) {
+    //回调和条件一起放到共享对象中, 到期时交出的回调只含一个shared_ptr, 不会超出内联缓冲区
+    Timer::ptr timer(new Timer(ms, std::move(cb), recurring, this));
+    if(!timer->m_shared) {
+        timer->m_shared.reset(new Timer::SharedCallback);
+        timer->m_shared->cb = std::move(timer->m_cb);
     }
-}
-
-Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring) {
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+    timer->m_shared->conditional = true;
+    timer->m_shared->cond = weak_cond;
+    RWMutexType::WriteLock wlock(m_mutex);
+    addTimer(timer, wlock);
+    return timer;
 }
 
 uint64_t TimerManager::getNextTimer() {
@@ -131,7 +141,7 @@ uint64_t TimerManager::getNextTimer() {
     }
 }
 
-void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs) {
+void TimerManager::listExpiredCb(std::vector<Callback>& cbs) {
     uint64_t now_ms = server::GetCurrentMS();
     std::vector<Timer::ptr> expired;
     
@@ -159,13 +169,29 @@ void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs) {
     cbs.reserve(expired.size());
 
     for(auto& timer : expired) {
-        cbs.push_back(timer->m_cb);
+        if(timer->m_shared) {
+            std::shared_ptr<Timer::SharedCallback> shared = timer->m_shared;
+            cbs.push_back([shared]() {
+                if(shared->conditional) {
+                    std::shared_ptr<void> tmp = shared->cond.lock();
+                    if(tmp) {
+                        shared->cb();
+                    }
+                    return;
+                }
+                shared->cb();
+            });
+        }
+        else {
+            cbs.push_back(std::move(timer->m_cb));
+        }
         if(timer->m_recurring) {
             timer->m_next = now_ms + timer->m_ms;
             m_timers.insert(timer);
         }
         else {
             timer->m_cb = nullptr;
+            timer->m_shared.reset();
         }
     }
 }
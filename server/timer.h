@@ -4,6 +4,7 @@
 #include <set>
 #include <vector>
 #include "thread.h"
+#include "callback.h"
 
 namespace server {
 class TimerManager;
@@ -16,17 +17,27 @@ public:
     bool refresh();
     bool reset(uint64_t ms, bool from_now);
 private:
-    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager);
+    Timer(uint64_t ms, Callback cb, bool recurring, TimerManager* manager);
     Timer(uint64_t next);
 
     struct Comparator {
         bool operator()(const Timer::ptr& lhs, const Timer::ptr& rhs);
     };
+
+    //循环或条件定时器的回调, 每次到期共享给执行方, 执行时再检查条件
+    struct SharedCallback {
+        Callback cb;
+        bool conditional = false;
+        std::weak_ptr<void> cond;
+    };
+
+    bool isActive() const { return m_cb || m_shared; }
 private:
     bool m_recurring = false;       //是否循环定时器
     uint64_t m_ms = 0;              //执行周期
     uint64_t m_next = 0;            //精确的执行时间
-    std::function<void()> m_cb;
+    Callback m_cb;                  //一次性定时器的回调, 到期时移交给执行方
+    std::shared_ptr<SharedCallback> m_shared;
     TimerManager* m_manager = nullptr;
 };
 
@@ -38,11 +49,12 @@ public:
     TimerManager();
     virtual ~TimerManager();
 
-    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
-    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false);
+    Timer::ptr addTimer(uint64_t ms, Callback cb, bool recurring = false);
+    //条件在回调执行时检查, 条件已失效则不执行
+    Timer::ptr addConditionTimer(uint64_t ms, Callback cb, std::weak_ptr<void> weak_cond, bool recurring = false);
 
     uint64_t getNextTimer();
-    void listExpiredCb(std::vector<std::function<void()>>& cbs);
+    void listExpiredCb(std::vector<Callback>& cbs);
     bool hasTimer();
 protected:
     virtual void onTimerInsertedAtFront() = 0;
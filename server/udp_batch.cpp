@@ -0,0 +1,83 @@
+#include "udp_batch.h"
+#include "hook.h"
+#include "log.h"
+#include "macro.h"
+#include <string.h>
+#include <sys/uio.h>
+
+namespace server {
+
+UdpBatch::UdpBatch(size_t batch, size_t buf_size)
+    : m_batch(batch)
+    , m_bufSize(buf_size)
+    , m_buffer(batch * buf_size)
+    , m_msgs(batch)
+    , m_iovs(batch)
+    , m_addrs(batch) {
+    SERVER_ASSERT(batch > 0 && buf_size > 0);
+    memset(&m_msgs[0], 0, sizeof(m_msgs[0]) * m_batch);
+    for(size_t i = 0; i < m_batch; ++i) {
+        m_iovs[i].iov_base = &m_buffer[i * m_bufSize];
+        m_msgs[i].msg_hdr.msg_iov = &m_iovs[i];
+        m_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+void UdpBatch::resetHeader(size_t idx, size_t len) {
+    msghdr& hdr = m_msgs[idx].msg_hdr;
+    m_iovs[idx].iov_len = len;
+    hdr.msg_name = &m_addrs[idx];
+    hdr.msg_namelen = sizeof(m_addrs[idx]);
+    hdr.msg_flags = 0;
+    m_msgs[idx].msg_len = 0;
+}
+
+int UdpBatch::recv(int sockfd, int flags) {
+    for(size_t i = 0; i < m_batch; ++i) {
+        resetHeader(i, m_bufSize);
+    }
+    m_count = 0;
+    int n = recvmmsg(sockfd, &m_msgs[0], m_batch, flags, nullptr);
+    if(n > 0) {
+        m_count = n;
+    }
+    return n;
+}
+
+bool UdpBatch::add(const void* data, size_t len, const sockaddr* addr, socklen_t addrlen) {
+    if(m_count >= m_batch || len > m_bufSize || addrlen > sizeof(sockaddr_storage)) {
+        return false;
+    }
+    resetHeader(m_count, len);
+    memcpy(&m_buffer[m_count * m_bufSize], data, len);
+    msghdr& hdr = m_msgs[m_count].msg_hdr;
+    if(addr) {
+        memcpy(&m_addrs[m_count], addr, addrlen);
+        hdr.msg_namelen = addrlen;
+    }
+    else {
+        hdr.msg_name = nullptr;
+        hdr.msg_namelen = 0;
+    }
+    ++m_count;
+    return true;
+}
+
+int UdpBatch::send(int sockfd, int flags) {
+    size_t total = m_count;
+    size_t sent = 0;
+    while(sent < total) {
+        int n = sendmmsg(sockfd, &m_msgs[sent], total - sent, flags);
+        if(n <= 0) {
+            break;
+        }
+        sent += n;
+    }
+    m_count = 0;
+    if(total && !sent) {
+        return -1;
+    }
+    return sent;
+}
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <sys/socket.h>
+#include "noncopyable.h"
+
+namespace server {
+
+//UDP批量收发, 基于hook后的recvmmsg/sendmmsg, 一次唤醒处理多个数据报
+//缓冲区在构造时分配, 之后反复使用
+class UdpBatch : Noncopyable {
+public:
+    typedef std::shared_ptr<UdpBatch> ptr;
+
+    //batch: 每次系统调用最多处理的数据报数, buf_size: 每个数据报的缓冲区大小
+    UdpBatch(size_t batch = 64, size_t buf_size = 2048);
+
+    size_t getBatch() const { return m_batch; }
+    size_t getBufSize() const { return m_bufSize; }
+
+    //挂起协程直到至少收到一个数据报, 返回收到的个数, 出错返回-1(errno同recvmmsg)
+    int recv(int sockfd, int flags = 0);
+    //上次recv收到的数据报个数
+    size_t size() const { return m_count; }
+    const char* data(size_t idx) const { return &m_buffer[idx * m_bufSize]; }
+    size_t length(size_t idx) const { return m_msgs[idx].msg_len; }
+    //数据报超过buf_size被截断
+    bool truncated(size_t idx) const { return m_msgs[idx].msg_hdr.msg_flags & MSG_TRUNC; }
+    const sockaddr* addr(size_t idx) const { return (const sockaddr*)&m_addrs[idx]; }
+    socklen_t addrlen(size_t idx) const { return m_msgs[idx].msg_hdr.msg_namelen; }
+
+    //清空待发送的数据报
+    void clear() { m_count = 0; }
+    //复制一个待发送的数据报, 批次已满或len超过buf_size返回false
+    //addr为nullptr时使用已connect的对端
+    bool add(const void* data, size_t len, const sockaddr* addr = nullptr, socklen_t addrlen = 0);
+    //发送所有待发送数据报, 返回发送的个数, 全部失败返回-1; 发送后清空
+    int send(int sockfd, int flags = 0);
+private:
+    void resetHeader(size_t idx, size_t len);
+private:
+    size_t m_batch;
+    size_t m_bufSize;
+    size_t m_count = 0;
+    std::vector<char> m_buffer;
+    std::vector<struct mmsghdr> m_msgs;
+    std::vector<struct iovec> m_iovs;
+    std::vector<sockaddr_storage> m_addrs;
+};
+
+}
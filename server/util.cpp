@@ -3,13 +3,29 @@
 #include "fiber.h"
 #include <execinfo.h>
 #include <sys/time.h>
+#include <pthread.h>
 
 namespace server{
 
 server::Logger::ptr g_logger = SERVER_LOG_NAME("system");
 
+//缓存线程id, 每条日志都会取, 避免每次一个系统调用
+static thread_local pid_t t_tid = 0;
+
+struct ThreadIdIniter {
+    ThreadIdIniter() {
+        //fork出的子进程中线程id变了
+        pthread_atfork(nullptr, nullptr, []() { t_tid = 0; });
+    }
+};
+
+static ThreadIdIniter s_thread_id_initer;
+
 pid_t GetThreadId(){
-    return syscall(SYS_gettid);
+    if(!t_tid) {
+        t_tid = syscall(SYS_gettid);
+    }
+    return t_tid;
 }
 
 uint32_t GetFiberId(){
@@ -0,0 +1,273 @@
+#include "zerocopy.h"
+#include "iomanager.h"
+#include "fd_manager.h"
+#include "hook.h"
+#include "log.h"
+#include <string.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+namespace server {
+
+static Logger::ptr g_logger = SERVER_LOG_NAME("system");
+
+ZeroCopySender::ZeroCopySender(int sockfd)
+    : m_state(new State) {
+    m_state->sock = sockfd;
+    int one = 1;
+    if(setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+        m_zerocopy = true;
+    } else {
+        SERVER_LOG_INFO(g_logger) << "SO_ZEROCOPY not supported fd=" << sockfd
+            << " errno=" << errno << " " << strerror(errno);
+    }
+}
+
+ZeroCopySender::~ZeroCopySender() {
+    if(getPending()) {
+        flush();
+    }
+}
+
+size_t ZeroCopySender::getPending() const {
+    MutexType::Lock lock(m_state->mutex);
+    return m_state->pending.size();
+}
+
+uint64_t ZeroCopySender::getCompleted() const {
+    MutexType::Lock lock(m_state->mutex);
+    return m_state->completed;
+}
+
+uint64_t ZeroCopySender::getCopied() const {
+    MutexType::Lock lock(m_state->mutex);
+    return m_state->copied;
+}
+
+ssize_t ZeroCopySender::send(const void* buf, size_t len, Callback done, int flags) {
+    int sock = m_state->sock;
+    const char* ptr = (const char*)buf;
+    size_t left = len;
+    if(!m_zerocopy) {
+        while(left > 0) {
+            ssize_t n = ::send(sock, ptr, left, flags);
+            if(n < 0) {
+                break;
+            }
+            ptr += n;
+            left -= n;
+        }
+        if(done) {
+            done();
+        }
+        return left ? -1 : (ssize_t)len;
+    }
+
+    //顺便释放已完成的缓冲区
+    Reap(*m_state);
+    bool sent = false;
+    while(left > 0) {
+        ssize_t n = ::send(sock, ptr, left, flags | MSG_ZEROCOPY);
+        if(n < 0) {
+            //未完成的通知超出optmem限制, 等一批完成后重试
+            if(errno == ENOBUFS && getPending() && !waitCompletion()) {
+                continue;
+            }
+            break;
+        }
+        //每次成功的zerocopy发送占用一个序号, 缓冲区在最后一个序号完成后释放
+        ++m_nextSeq;
+        sent = true;
+        ptr += n;
+        left -= n;
+    }
+
+    if(!sent) {
+        int err = errno;
+        if(done) {
+            done();
+        }
+        errno = err;
+        return -1;
+    }
+    Pending pending;
+    pending.lastSeq = m_nextSeq - 1;
+    pending.done = std::move(done);
+    IOManager* iom = IOManager::GetThis();
+    {
+        MutexType::Lock lock(m_state->mutex);
+        m_state->pending.push_back(std::move(pending));
+        if(iom && is_hook_enable() && !m_state->iom) {
+            ArmNoLock(m_state, iom);
+        }
+    }
+    return left ? -1 : (ssize_t)len;
+}
+
+int ZeroCopySender::flush() {
+    Reap(*m_state);
+    while(getPending()) {
+        if(waitCompletion()) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int ZeroCopySender::ReapNoLock(State& st, std::vector<Callback>& dones) {
+    int count = 0;
+    while(true) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        //错误队列不会阻塞, 直接调用原始函数避免hook挂起协程
+        if(recvmsg_f(st.sock, &msg, MSG_ERRQUEUE) < 0) {
+            break;
+        }
+        for(struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                    || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cm);
+            if(serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+                continue;
+            }
+            if(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                st.copied += serr->ee_data - serr->ee_info + 1;
+            }
+            CompleteNoLock(st, serr->ee_info, serr->ee_data, dones);
+            ++count;
+        }
+    }
+    return count;
+}
+
+void ZeroCopySender::CompleteNoLock(State& st, uint32_t lo, uint32_t hi, std::vector<Callback>& dones) {
+    if(SeqBefore(st.doneSeq, lo)) {
+        st.outOfOrder[lo] = hi;
+        return;
+    }
+    if(!SeqBefore(hi, st.doneSeq)) {
+        st.doneSeq = hi + 1;
+    }
+    auto it = st.outOfOrder.begin();
+    while(it != st.outOfOrder.end() && !SeqBefore(st.doneSeq, it->first)) {
+        if(!SeqBefore(it->second, st.doneSeq)) {
+            st.doneSeq = it->second + 1;
+        }
+        it = st.outOfOrder.erase(it);
+    }
+
+    while(!st.pending.empty() && SeqBefore(st.pending.front().lastSeq, st.doneSeq)) {
+        if(st.pending.front().done) {
+            dones.push_back(std::move(st.pending.front().done));
+        }
+        st.pending.pop_front();
+        ++st.completed;
+    }
+}
+
+int ZeroCopySender::Reap(State& st) {
+    std::vector<Callback> dones;
+    int count = 0;
+    {
+        MutexType::Lock lock(st.mutex);
+        count = ReapNoLock(st, dones);
+    }
+    for(auto& i : dones) {
+        i();
+    }
+    return count;
+}
+
+void ZeroCopySender::ArmNoLock(const State::ptr& st, IOManager* iom) {
+    FdCtx* ctx = FdMgr::GetInstance()->get(st->sock);
+    if(ctx) {
+        ctx->setIOManager(iom);
+    }
+    State::ptr self = st;
+    if(iom->addEvent(st->sock, IOManager::ERROR, [self]() { OnError(self); }) == 0) {
+        st->iom = iom;
+    }
+}
+
+void ZeroCopySender::OnError(const State::ptr& st) {
+    std::vector<Callback> dones;
+    Fiber::ptr waiter;
+    Scheduler* scheduler = nullptr;
+    IOManager* iom = nullptr;
+    int count = 0;
+    {
+        MutexType::Lock lock(st->mutex);
+        iom = st->iom;
+        st->iom = nullptr;
+        count = ReapNoLock(*st, dones);
+        //只在取到完成通知时继续登记, 否则是socket本身出错, 重新登记会立即再次触发
+        if(count > 0 && !st->pending.empty()) {
+            ArmNoLock(st, iom);
+        }
+        waiter.swap(st->waiter);
+        scheduler = st->waiterScheduler;
+    }
+    if(!count) {
+        //EPOLLERR交给了本回调, 不是完成通知时唤醒读写等待者, 由它们的调用取得错误
+        iom->cancelEvent(st->sock, IOManager::READ);
+        iom->cancelEvent(st->sock, IOManager::WRITE);
+    }
+    for(auto& i : dones) {
+        i();
+    }
+    if(waiter) {
+        scheduler->schedule(std::move(waiter));
+    }
+}
+
+int ZeroCopySender::waitCompletion() {
+    if(Reap(*m_state) > 0) {
+        return 0;
+    }
+    IOManager* iom = IOManager::GetThis();
+    if(!iom || !is_hook_enable()) {
+        //不在调度线程中, POLLERR总会返回, 不用设置events
+        struct pollfd pfd = {m_state->sock, 0, 0};
+        if(poll_f(&pfd, 1, -1) < 0) {
+            return -1;
+        }
+        Reap(*m_state);
+        return 0;
+    }
+    uint64_t completed = 0;
+    {
+        MutexType::Lock lock(m_state->mutex);
+        if(m_state->pending.empty()) {
+            return 0;
+        }
+        completed = m_state->completed;
+        if(!m_state->iom) {
+            ArmNoLock(m_state, iom);
+            if(!m_state->iom) {
+                return -1;
+            }
+        }
+        m_state->waiter = Fiber::GetThis();
+        m_state->waiterScheduler = iom;
+    }
+    //由ERROR回调取走完成通知后唤醒
+    Fiber::YieldToHold();
+    if(getCompleted() != completed || Reap(*m_state) > 0) {
+        return 0;
+    }
+    //没有完成通知却被唤醒, socket已出错
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if(getsockopt(m_state->sock, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+}
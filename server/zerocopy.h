@@ -0,0 +1,94 @@
+#pragma once
+
+#include <memory>
+#include <deque>
+#include <map>
+#include <vector>
+#include <sys/types.h>
+#include "callback.h"
+#include "fiber.h"
+#include "thread.h"
+#include "noncopyable.h"
+
+namespace server {
+
+class IOManager;
+class Scheduler;
+
+//基于MSG_ZEROCOPY的TCP发送: 内核直接引用用户缓冲区, 不再拷贝到socket缓冲区
+//内核不再引用缓冲区后通过socket错误队列发出完成通知, 此时才调用done释放缓冲区
+//一个socket只能有一个ZeroCopySender, send/flush应在同一个协程中调用
+//在IOManager中使用时, 有未完成的发送期间在socket上登记ERROR事件, 由IOManager及时取走完成通知,
+//避免错误队列非空让该socket上的读写等待者反复被唤醒; 此时done可能在IOManager的工作线程中调用
+class ZeroCopySender : Noncopyable {
+public:
+    typedef std::shared_ptr<ZeroCopySender> ptr;
+    typedef Mutex MutexType;
+
+    //开启SO_ZEROCOPY, 内核不支持时退化为普通send
+    ZeroCopySender(int sockfd);
+    //等待所有完成通知
+    ~ZeroCopySender();
+
+    int getSocket() const { return m_state->sock; }
+    bool isZeroCopy() const { return m_zerocopy; }
+
+    //发送buf[0, len)的全部数据, 成功返回len, 出错返回-1(errno同send)
+    //done在内核不再引用buf后调用, 可能在之后的send/flush中或IOManager线程中; 出错时同样会调用
+    ssize_t send(const void* buf, size_t len, Callback done, int flags = 0);
+    //挂起直到所有缓冲区的done都已调用, 成功返回0
+    int flush();
+
+    //尚未完成的缓冲区个数
+    size_t getPending() const;
+    //已完成的缓冲区个数
+    uint64_t getCompleted() const;
+    //内核退化为拷贝的发送次数(如环回设备、网卡不支持scatter-gather)
+    uint64_t getCopied() const;
+private:
+    //内核的序号是32位计数, 会回绕, 按差值比较先后
+    static bool SeqBefore(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+    //未完成的序号远小于2^31, 窗口内该比较是严格弱序
+    struct SeqLess {
+        bool operator()(uint32_t a, uint32_t b) const { return SeqBefore(a, b); }
+    };
+
+    struct Pending {
+        uint32_t lastSeq;
+        Callback done;
+    };
+
+    //完成状态, 与IOManager中的ERROR回调共享, 回调可能晚于ZeroCopySender析构执行
+    struct State {
+        typedef std::shared_ptr<State> ptr;
+        MutexType mutex;
+        int sock = -1;
+        //小于该序号的发送都已完成
+        uint32_t doneSeq = 0;
+        //乱序到达的完成区间 lo -> hi
+        std::map<uint32_t, uint32_t, SeqLess> outOfOrder;
+        std::deque<Pending> pending;
+        uint64_t completed = 0;
+        uint64_t copied = 0;
+        IOManager* iom = nullptr;       //已登记ERROR事件的IOManager, nullptr表示未登记
+        Fiber::ptr waiter;              //flush中等待完成的协程
+        Scheduler* waiterScheduler = nullptr;
+    };
+
+    //非阻塞读取错误队列中的完成通知, 返回读到的通知数, 已完成的done放入dones由调用方在锁外调用
+    static int ReapNoLock(State& st, std::vector<Callback>& dones);
+    static void CompleteNoLock(State& st, uint32_t lo, uint32_t hi, std::vector<Callback>& dones);
+    static int Reap(State& st);
+    //在iom上登记ERROR事件, 有完成通知时取走并唤醒flush
+    static void ArmNoLock(const State::ptr& st, IOManager* iom);
+    static void OnError(const State::ptr& st);
+    //等到有新的完成通知
+    int waitCompletion();
+private:
+    bool m_zerocopy = false;
+    //下一次zerocopy发送的序号, 与内核中该socket的计数一致
+    uint32_t m_nextSeq = 0;
+    State::ptr m_state;
+};
+
+}
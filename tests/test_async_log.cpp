@@ -0,0 +1,71 @@
+#include "server/server.h"
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const int s_threads = 4;
+static const int s_loops = 50000;
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//多个线程同时写日志, 统计总吞吐和单次调用耗时分布
+void bench(const std::string& name, server::LogAppender::ptr appender) {
+    server::Logger::ptr logger(new server::Logger(name));
+    logger->addAppender(appender);
+
+    std::vector<std::vector<uint32_t> > costs(s_threads);
+    std::vector<server::Thread::ptr> thrs;
+    uint64_t begin = now_ns();
+    for(int i = 0; i < s_threads; ++i) {
+        costs[i].resize(s_loops);
+        thrs.push_back(server::Thread::ptr(new server::Thread([logger, &costs, i]() {
+            for(int j = 0; j < s_loops; ++j) {
+                uint64_t t = now_ns();
+                SERVER_LOG_INFO(logger) << "benchmark message " << j << " from worker " << i;
+                costs[i][j] = now_ns() - t;
+            }
+        }, name + "_" + std::to_string(i))));
+    }
+    for(auto& i : thrs) {
+        i->join();
+    }
+    uint64_t produced = now_ns() - begin;
+    auto async = std::dynamic_pointer_cast<server::AsyncFileLogAppender>(appender);
+    if(async) {
+        async->flush();
+    }
+    uint64_t flushed = now_ns() - begin;
+
+    std::vector<uint32_t> all;
+    for(auto& i : costs) {
+        all.insert(all.end(), i.begin(), i.end());
+    }
+    std::sort(all.begin(), all.end());
+    uint64_t total = (uint64_t)s_threads * s_loops;
+    SERVER_LOG_INFO(g_logger) << name << ": " << total << " logs, producers done in "
+        << produced / 1000000 << "ms (" << total * 1000000000 / produced << "/s), on disk in "
+        << flushed / 1000000 << "ms, call p50=" << all[all.size() / 2]
+        << "ns p99=" << all[all.size() * 99 / 100] << "ns max=" << all.back() << "ns"
+        << (async ? " dropped=" + std::to_string(async->getDropped()) : std::string());
+}
+
+int main() {
+    unlink("/tmp/test_async_log_sync.txt");
+    unlink("/tmp/test_async_log_async.txt");
+    unlink("/tmp/test_async_log_drop.txt");
+
+    bench("sync", server::LogAppender::ptr(
+                new server::FileLogAppender("/tmp/test_async_log_sync.txt")));
+    bench("async_block", server::LogAppender::ptr(
+                new server::AsyncFileLogAppender("/tmp/test_async_log_async.txt")));
+    //队列很小时按策略丢弃, 调用方不等待磁盘
+    bench("async_drop", server::LogAppender::ptr(
+                new server::AsyncFileLogAppender("/tmp/test_async_log_drop.txt", 256,
+                    server::AsyncFileLogAppender::DROP)));
+    return 0;
+}
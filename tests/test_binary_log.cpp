@@ -0,0 +1,85 @@
+#include "server/server.h"
+#include <chrono>
+#include <fstream>
+#include <unistd.h>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const int s_loops = 200000;
+static const std::string s_pattern = "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n";
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string read_file(const std::string& name) {
+    std::ifstream ifs(name, std::ios::binary);
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    return ss.str();
+}
+
+//同一批事件同时写文本和二进制, 解码后应与文本完全一致
+void test_roundtrip() {
+    unlink("/tmp/test_binary_log.txt");
+    unlink("/tmp/test_binary_log.bin");
+    server::Logger::ptr logger(new server::Logger("roundtrip"));
+    server::LogAppender::ptr text(new server::FileLogAppender("/tmp/test_binary_log.txt"));
+    text->setFormatter(server::LogFormatter::ptr(new server::LogFormatter(s_pattern)));
+    server::BinaryLogAppender::ptr bin(new server::BinaryLogAppender("/tmp/test_binary_log.bin"));
+    logger->addAppender(text);
+    logger->addAppender(bin);
+    for(int i = 0; i < 1000; ++i) {
+        if(i % 3) {
+            SERVER_LOG_INFO(logger) << "roundtrip " << i << " value=" << i * 1.5;
+        } else {
+            SERVER_LOG_ERROR(logger) << "error " << i << " with\ttab";
+        }
+    }
+    logger->clearAppenders();
+    text.reset();
+    bin.reset();
+
+    server::BinaryLogReader reader;
+    SERVER_ASSERT(reader.open("/tmp/test_binary_log.bin"));
+    server::LogFormatter fmt(s_pattern);
+    std::stringstream decoded;
+    server::LogEvent::ptr event;
+    int count = 0;
+    while(reader.next(event)) {
+        fmt.format(decoded, event->getLogger(), event->getLevel(), event);
+        ++count;
+    }
+    SERVER_ASSERT(!reader.isError());
+    bool same = decoded.str() == read_file("/tmp/test_binary_log.txt");
+    SERVER_LOG_INFO(g_logger) << "roundtrip: decoded " << count << " events, same as text: " << same;
+    SERVER_ASSERT(count == 1000 && same);
+}
+
+void bench(const std::string& name, const std::string& file, server::LogAppender::ptr appender) {
+    server::Logger::ptr logger(new server::Logger("bench"));
+    logger->addAppender(appender);
+    uint64_t begin = now_ns();
+    for(int i = 0; i < s_loops; ++i) {
+        SERVER_LOG_INFO(logger) << "request " << i << " from 127.0.0.1 done, cost=" << 1.5 << "ms";
+    }
+    logger->clearAppenders();
+    appender.reset();
+    uint64_t cost = now_ns() - begin;
+    SERVER_LOG_INFO(g_logger) << name << ": " << cost / s_loops << " ns/event, "
+        << read_file(file).size() / s_loops << " bytes/event";
+}
+
+int main() {
+    test_roundtrip();
+    unlink("/tmp/test_binary_log.txt");
+    unlink("/tmp/test_binary_log.bin");
+    bench("text", "/tmp/test_binary_log.txt",
+            server::LogAppender::ptr(new server::FileLogAppender("/tmp/test_binary_log.txt")));
+    bench("binary", "/tmp/test_binary_log.bin",
+            server::LogAppender::ptr(new server::BinaryLogAppender("/tmp/test_binary_log.bin")));
+    unlink("/tmp/test_binary_log.txt");
+    unlink("/tmp/test_binary_log.bin");
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include "server/server.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static std::atomic<uint64_t> s_alloc_count {0};
+
+void* operator new(size_t size) {
+    ++s_alloc_count;
+    void* p = malloc(size);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+static const int s_loops = 1000000;
+static std::atomic<uint64_t> s_sum {0};
+
+//捕获内容与hook中do_io超时回调相当: weak_ptr + fd + iomanager + event
+struct Capture {
+    std::weak_ptr<int> winfo;
+    int fd;
+    void* iom;
+    uint32_t event;
+};
+
+template<class Fun>
+void bench_construct(const char* name) {
+    std::shared_ptr<int> info(new int(1));
+    Capture c{info, 3, nullptr, 1};
+    uint64_t allocs = s_alloc_count;
+    uint64_t begin = server::GetCurrentUS();
+    for(int i = 0; i < s_loops; ++i) {
+        Fun f([c]() {
+            s_sum += c.fd;
+        });
+        Fun g(std::move(f));
+        g();
+    }
+    uint64_t used = server::GetCurrentUS() - begin;
+    SERVER_LOG_INFO(g_logger) << name << ": " << used * 1000.0 / s_loops << " ns/op "
+        << (s_alloc_count - allocs) * 1.0 / s_loops << " allocs/op";
+}
+
+void bench_schedule() {
+    std::shared_ptr<int> info(new int(1));
+    Capture c{info, 3, nullptr, 1};
+    server::Scheduler sc(1, false, "bench");
+    sc.start();
+    uint64_t allocs = s_alloc_count;
+    uint64_t begin = server::GetCurrentUS();
+    for(int i = 0; i < s_loops; ++i) {
+        sc.schedule([c]() {
+            s_sum += c.fd;
+        });
+    }
+    sc.stop();
+    uint64_t used = server::GetCurrentUS() - begin;
+    SERVER_LOG_INFO(g_logger) << "schedule+dequeue: " << s_loops * 1000000.0 / used << " tasks/s "
+        << (s_alloc_count - allocs) * 1.0 / s_loops << " allocs/task";
+}
+
+static_assert(!std::is_copy_constructible<server::Callback>::value, "Callback must be move-only");
+
+struct MoveOnly {
+    std::unique_ptr<int> p;
+    void operator()() { s_sum += *p; }
+};
+
+class TestTimerManager : public server::TimerManager {
+protected:
+    void onTimerInsertedAtFront() override {}
+};
+
+//只能移动的捕获, 以及循环定时器多次到期
+void test_move_only() {
+    MoveOnly f;
+    f.p.reset(new int(7));
+    server::Callback cb(std::move(f));
+    uint64_t sum = s_sum;
+    server::Callback moved(std::move(cb));
+    SERVER_ASSERT(!cb && moved);
+    moved();
+    SERVER_ASSERT(s_sum == sum + 7);
+
+    TestTimerManager tm;
+    std::shared_ptr<int> count(new int(0));
+    tm.addTimer(0, [count]() { ++*count; }, true);
+    for(int i = 0; i < 3; ++i) {
+        std::vector<server::Callback> cbs;
+        usleep(2000);
+        tm.listExpiredCb(cbs);
+        for(auto& i : cbs) {
+            i();
+        }
+    }
+    SERVER_LOG_INFO(g_logger) << "move only ok, recurring timer fired " << *count << " times";
+    SERVER_ASSERT(*count == 3);
+}
+
+//条件在取出回调之后、执行之前失效, 回调不应执行
+void test_condition_timer() {
+    TestTimerManager tm;
+    std::shared_ptr<int> cond(new int(0));
+    int called = 0;
+    tm.addConditionTimer(0, [&called]() { ++called; }, cond);
+    std::vector<server::Callback> cbs;
+    usleep(2000);
+    tm.listExpiredCb(cbs);
+    SERVER_ASSERT(cbs.size() == 1);
+    cond.reset();
+    cbs[0]();
+    SERVER_LOG_INFO(g_logger) << "condition expired before run, called=" << called;
+    SERVER_ASSERT(called == 0);
+}
+
+int main() {
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+    SERVER_LOG_INFO(g_logger) << "sizeof(Capture)=" << sizeof(Capture)
+        << " sizeof(Callback)=" << sizeof(server::Callback)
+        << " inline=" << server::Callback::FitsInline<Capture>();
+    bench_construct<std::function<void()>>("std::function");
+    bench_construct<server::Callback>("server::Callback");
+    bench_schedule();
+    test_move_only();
+    test_condition_timer();
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "server/server.h"
+#include "server/hook.h"
+#include "server/fd_manager.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const int s_conns = 20000;
+
+static sockaddr_in s_addr;
+static int s_listen = -1;
+static bool s_legacy = false;
+
+//legacy: 按旧方式创建阻塞socket, 再由FdCtx::init执行fstat + fcntl设置非阻塞
+int client_socket() {
+    if(!s_legacy) {
+        return socket(AF_INET, SOCK_STREAM, 0);
+    }
+    int fd = socket_f(AF_INET, SOCK_STREAM, 0);
+    server::FdMgr::GetInstance()->get(fd, true);
+    return fd;
+}
+
+void bench(bool legacy) {
+    s_legacy = legacy;
+    uint64_t begin = server::GetCurrentUS();
+    {
+        server::IOManager iom(1, false, "churn");
+        iom.schedule([]() {
+            for(int i = 0; i < s_conns; ++i) {
+                int fd = accept(s_listen, nullptr, nullptr);
+                close(fd);
+            }
+        });
+        iom.schedule([]() {
+            for(int i = 0; i < s_conns; ++i) {
+                int fd = client_socket();
+                connect(fd, (const sockaddr*)&s_addr, sizeof(s_addr));
+                close(fd);
+            }
+        });
+    }
+    uint64_t used = server::GetCurrentUS() - begin;
+    SERVER_LOG_INFO(g_logger) << (legacy ? "socket+fstat+fcntl" : "SOCK_NONBLOCK     ") << ": "
+        << s_conns << " connections in " << used / 1000 << "ms "
+        << (uint64_t)(s_conns * 1000000.0 / used) << " conn/s";
+}
+
+int main() {
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+    s_listen = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(s_listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&s_addr, 0, sizeof(s_addr));
+    s_addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &s_addr.sin_addr.s_addr);
+    socklen_t len = sizeof(s_addr);
+    bind(s_listen, (const sockaddr*)&s_addr, sizeof(s_addr));
+    listen(s_listen, 1024);
+    getsockname(s_listen, (sockaddr*)&s_addr, &len);
+
+    bench(true);
+    bench(false);
+    close(s_listen);
+    return 0;
+}
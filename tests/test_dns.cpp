@@ -0,0 +1,201 @@
+#include "server/server.h"
+#include "server/hook.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <fstream>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static sockaddr_in s_addr;
+static std::atomic<bool> s_stop {false};
+static std::atomic<int> s_queries {0};
+
+static std::atomic<int> s_tcp_queries {0};
+
+//构造应答, 返回空串表示不应答
+//www.test: 两条A记录, TTL 1秒; nx.test: NXDOMAIN; slow.test: 不应答
+//big.test: UDP只返回一条记录并置TC, TCP返回三条
+std::string make_response(const uint8_t* buf, size_t n, bool tcp) {
+    std::string name;
+    size_t pos = 12;
+    while(pos < n && buf[pos]) {
+        if(!name.empty()) {
+            name.push_back('.');
+        }
+        name.append((const char*)buf + pos + 1, buf[pos]);
+        pos += buf[pos] + 1;
+    }
+    pos += 5;
+    if(name == "slow.test" || pos > n) {
+        return "";
+    }
+    //放大查询耗时, 便于观察并发合并
+    usleep(50 * 1000);
+    std::string resp((const char*)buf, pos);
+    resp[2] = 0x81;
+    resp[3] = 0x80;
+    int count = 2;
+    if(name == "big.test") {
+        count = tcp ? 3 : 1;
+        if(!tcp) {
+            resp[2] |= 0x02;
+        }
+    }
+    if(name == "nx.test") {
+        resp[3] |= 3;
+    } else {
+        resp[7] = count;
+        for(int i = 1; i <= count; ++i) {
+            const uint8_t rr[] = {0xC0, 0x0C, 0, 1, 0, 1, 0, 0, 0, 1, 0, 4, 10, 0, 0, (uint8_t)i};
+            resp.append((const char*)rr, sizeof(rr));
+        }
+    }
+    return resp;
+}
+
+//本地桩DNS服务器, 运行在未开启hook的独立线程中
+void stub_server(int sock) {
+    uint8_t buf[512];
+    while(!s_stop) {
+        sockaddr_in peer;
+        socklen_t len = sizeof(peer);
+        ssize_t n = recvfrom(sock, buf, sizeof(buf), 0, (sockaddr*)&peer, &len);
+        if(n < 12) {
+            continue;
+        }
+        ++s_queries;
+        std::string resp = make_response(buf, n, false);
+        if(!resp.empty()) {
+            sendto(sock, resp.data(), resp.size(), 0, (const sockaddr*)&peer, len);
+        }
+    }
+}
+
+//同端口的TCP桩服务器, 每个连接处理一个查询
+void stub_tcp_server(int sock) {
+    while(!s_stop) {
+        int conn = accept(sock, nullptr, nullptr);
+        if(conn < 0) {
+            continue;
+        }
+        ++s_tcp_queries;
+        uint8_t buf[514];
+        size_t got = 0;
+        while(got < 2 || got < 2u + ((buf[0] << 8) | buf[1])) {
+            ssize_t n = recv(conn, buf + got, sizeof(buf) - got, 0);
+            if(n <= 0) {
+                break;
+            }
+            got += n;
+        }
+        if(got >= 14) {
+            std::string resp = make_response(buf + 2, got - 2, true);
+            std::string out;
+            out.push_back((char)(resp.size() >> 8));
+            out.push_back((char)resp.size());
+            out.append(resp);
+            send(conn, out.data(), out.size(), MSG_NOSIGNAL);
+        }
+        close(conn);
+    }
+}
+
+std::string to_string(const std::vector<in_addr>& addrs) {
+    std::string str;
+    for(auto& i : addrs) {
+        str += (str.empty() ? "" : ",") + std::string(inet_ntoa(i));
+    }
+    return str;
+}
+
+void lookup(const std::string& host) {
+    std::vector<in_addr> addrs;
+    int queries = s_queries;
+    uint64_t begin = server::GetCurrentMS();
+    int rt = server::DnsMgr::GetInstance()->resolve(host, addrs);
+    SERVER_LOG_INFO(g_logger) << host << " rt=" << rt << "(" << (rt ? gai_strerror(rt) : "ok") << ")"
+        << " addrs=" << to_string(addrs) << " used=" << server::GetCurrentMS() - begin << "ms"
+        << " queries=" << s_queries - queries;
+}
+
+void run() {
+    auto dns = server::DnsMgr::GetInstance();
+    //10个协程同时解析同一名字, 只发一次查询
+    int queries = s_queries;
+    uint64_t begin = server::GetCurrentMS();
+    int done = 0;
+    for(int i = 0; i < 10; ++i) {
+        server::IOManager::GetThis()->schedule([&done]() {
+            std::vector<in_addr> addrs;
+            server::DnsMgr::GetInstance()->resolve("www.test", addrs);
+            ++done;
+        });
+    }
+    while(done < 10) {
+        usleep(10 * 1000);
+    }
+    SERVER_LOG_INFO(g_logger) << "10 concurrent lookups used=" << server::GetCurrentMS() - begin
+        << "ms queries=" << s_queries - queries << " coalesced=" << dns->getCoalesced();
+
+    lookup("www.test");
+    lookup("WWW.test.");
+    usleep(1100 * 1000);
+    SERVER_LOG_INFO(g_logger) << "after ttl";
+    lookup("www.test");
+    lookup("nx.test");
+    lookup("nx.test");
+    lookup("myhost.test");
+    lookup("127.0.0.1");
+    lookup("slow.test");
+
+    //截断的UDP应答改走TCP, 得到完整结果后才缓存
+    std::vector<in_addr> addrs;
+    int rt = dns->resolve("big.test", addrs);
+    SERVER_ASSERT(rt == 0 && addrs.size() == 3 && s_tcp_queries == 1);
+    queries = s_queries;
+    rt = dns->resolve("big.test", addrs);
+    SERVER_ASSERT(rt == 0 && addrs.size() == 3 && s_queries == queries);
+    SERVER_LOG_INFO(g_logger) << "big.test addrs=" << to_string(addrs) << " tcp_queries=" << s_tcp_queries;
+    SERVER_LOG_INFO(g_logger) << "cache_hits=" << dns->getCacheHits()
+        << " query_count=" << dns->getQueryCount();
+}
+
+int main() {
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&s_addr, 0, sizeof(s_addr));
+    s_addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &s_addr.sin_addr);
+    bind(sock, (const sockaddr*)&s_addr, sizeof(s_addr));
+    socklen_t len = sizeof(s_addr);
+    getsockname(sock, (sockaddr*)&s_addr, &len);
+    timeval tv = {0, 100 * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    server::Thread::ptr stub(new server::Thread(std::bind(stub_server, sock), "dns_stub"));
+
+    int tcp_sock = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(tcp_sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    bind(tcp_sock, (const sockaddr*)&s_addr, sizeof(s_addr));
+    listen(tcp_sock, 16);
+    setsockopt(tcp_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    server::Thread::ptr tcp_stub(new server::Thread(std::bind(stub_tcp_server, tcp_sock), "dns_tcp_stub"));
+
+    std::ofstream("/tmp/test_dns_hosts") << "# test hosts\n10.1.2.3 myhost.test alias.test\n";
+    server::Config::Lookup<std::vector<std::string> >("dns.nameservers")->setValue(
+        {"127.0.0.1:" + std::to_string(ntohs(s_addr.sin_port))});
+    server::Config::Lookup<std::string>("dns.hosts")->setValue("/tmp/test_dns_hosts");
+    server::Config::Lookup<uint32_t>("dns.timeout_ms")->setValue(200);
+    {
+        server::IOManager iom(1, false, "dns");
+        iom.schedule(run);
+    }
+    s_stop = true;
+    stub->join();
+    tcp_stub->join();
+    close(sock);
+    close(tcp_sock);
+    return 0;
+}
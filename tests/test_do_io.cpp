@@ -0,0 +1,108 @@
+#include "server/server.h"
+#include "server/hook.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <new>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static std::atomic<uint64_t> s_alloc_count {0};
+
+void* operator new(size_t size) {
+    ++s_alloc_count;
+    void* p = malloc(size);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+static const int s_loops = 1000000;
+static const int s_rounds = 20;
+
+//长度为0的read在socket上立即返回0, 只剩系统调用本身和hook的开销
+void bench() {
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr.s_addr);
+    socklen_t len = sizeof(addr);
+    bind(lfd, (const sockaddr*)&addr, sizeof(addr));
+    listen(lfd, 16);
+    getsockname(lfd, (sockaddr*)&addr, &len);
+    int cfd = socket(AF_INET, SOCK_STREAM, 0);
+    connect(cfd, (const sockaddr*)&addr, sizeof(addr));
+
+    //原始调用和hook调用交替分轮执行, 各取最快的一轮, 减少机器抖动的影响
+    char buf[1];
+    uint64_t raw_us = -1;
+    uint64_t hook_us = -1;
+    uint64_t allocs = 0;
+    for(int round = 0; round < s_rounds; ++round) {
+        uint64_t begin = server::GetCurrentUS();
+        for(int i = 0; i < s_loops / s_rounds; ++i) {
+            read_f(cfd, buf, 0);
+        }
+        raw_us = std::min(raw_us, server::GetCurrentUS() - begin);
+
+        uint64_t count = s_alloc_count;
+        begin = server::GetCurrentUS();
+        for(int i = 0; i < s_loops / s_rounds; ++i) {
+            read(cfd, buf, 0);
+        }
+        hook_us = std::min(hook_us, server::GetCurrentUS() - begin);
+        allocs += s_alloc_count - count;
+    }
+
+    int per_round = s_loops / s_rounds;
+    SERVER_LOG_INFO(g_logger) << "raw read: " << raw_us * 1000.0 / per_round << " ns/call "
+        << "hooked read: " << hook_us * 1000.0 / per_round << " ns/call "
+        << "overhead: " << ((int64_t)hook_us - (int64_t)raw_us) * 1000.0 / per_round << " ns/call "
+        << allocs * 1.0 / s_loops << " allocs/call";
+    //快速路径上不能有堆分配
+    SERVER_ASSERT(allocs == 0);
+    close(cfd);
+    close(lfd);
+}
+
+//阻塞在read上的fd被其他协程关闭, fd号随即被新socket复用, read返回EBADF而不是去读新socket
+void test_reuse() {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    server::IOManager::GetThis()->schedule([fds]() {
+        usleep(10 * 1000);
+        close(fds[0]);
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(fd != fds[0]) {
+            dup2(fd, fds[0]);
+            close(fd);
+        }
+        SERVER_LOG_INFO(g_logger) << "closed fd=" << fds[0] << ", reused by a new socket";
+        usleep(10 * 1000);
+        close(fds[0]);
+    });
+    char buf[1];
+    ssize_t rt = read(fds[0], buf, sizeof(buf));
+    SERVER_LOG_INFO(g_logger) << "read on closed fd rt=" << rt << " errno=" << errno
+        << " (" << strerror(errno) << ")";
+    SERVER_ASSERT(rt == -1 && errno == EBADF);
+    close(fds[1]);
+}
+
+int main() {
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+    server::IOManager iom(1, false, "do_io");
+    iom.schedule(bench);
+    iom.schedule(test_reuse);
+    return 0;
+}
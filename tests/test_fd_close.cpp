@@ -0,0 +1,165 @@
+#include "server/server.h"
+#include "server/hook.h"
+#include "server/fd_manager.h"
+#include <sys/socket.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const int s_loops = 2000;
+
+static std::atomic<int> s_reader_ebadf {0};
+static std::atomic<int> s_writer_ebadf {0};
+static std::atomic<int> s_corrupted {0};
+static std::atomic<int> s_other {0};
+static std::atomic<int> s_done {0};
+
+//阻塞在读上, 只应该读到本连接的数据或EBADF
+void reader(int fd, char tag) {
+    char c = 0;
+    ssize_t rt = read(fd, &c, 1);
+    if(rt == 1 && c != tag) {
+        ++s_corrupted;
+    } else if(rt == -1 && errno == EBADF) {
+        ++s_reader_ebadf;
+    } else {
+        ++s_other;
+    }
+    ++s_done;
+}
+
+//写满发送缓冲区后阻塞
+void writer(int fd) {
+    static char buf[64 * 1024];
+    ssize_t rt = 0;
+    while((rt = write(fd, buf, sizeof(buf))) > 0);
+    if(rt == -1 && errno == EBADF) {
+        ++s_writer_ebadf;
+    } else {
+        ++s_other;
+    }
+    ++s_done;
+}
+
+void run() {
+    uint64_t begin = server::GetCurrentMS();
+    for(int i = 0; i < s_loops; ++i) {
+        int fds[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        int done = s_done + 2;
+        server::IOManager* iom = server::IOManager::GetThis();
+        iom->schedule(std::bind(reader, fds[0], 'a'));
+        iom->schedule(std::bind(writer, fds[0]));
+        //等两个协程都挂起; 还没开始读写的协程在fd复用后操作的是新连接, 那是调用方自己的竞争
+        while(!iom->hasEvent(fds[0], server::IOManager::READ)
+                || !iom->hasEvent(fds[0], server::IOManager::WRITE)) {
+            usleep(100);
+        }
+
+        //关闭后立即新建连接, fd号被复用, 对端写入另一个连接的数据
+        close(fds[0]);
+        int reuse[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, reuse);
+        write(reuse[1], "b", 1);
+        while(s_done < done) {
+            usleep(1000);
+        }
+        close(reuse[0]);
+        close(reuse[1]);
+        close(fds[1]);
+    }
+    SERVER_LOG_INFO(g_logger) << s_loops << " close-while-blocked rounds in "
+        << server::GetCurrentMS() - begin << "ms: reader EBADF=" << s_reader_ebadf
+        << " writer EBADF=" << s_writer_ebadf << " cross-connection reads=" << s_corrupted
+        << " other=" << s_other;
+}
+
+//在未开启hook、不属于任何IOManager的线程中close, 也要唤醒挂在该fd上的协程
+void test_close_from_thread() {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    std::atomic<int> result {-1};
+    {
+        server::IOManager iom(1, false, "fd_owner");
+        int fd = fds[0];
+        iom.schedule([fd, &result]() {
+            //超时只作兜底
+            timeval tv = {2, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            char c = 0;
+            ssize_t rt = read(fd, &c, 1);
+            result = rt == -1 ? errno : 0;
+        });
+        while(!iom.hasEvent(fd, server::IOManager::READ)) {
+            usleep(100);
+        }
+        uint64_t begin = server::GetCurrentMS();
+        close(fd);
+        while(result == -1) {
+            usleep(1000);
+        }
+        uint64_t used = server::GetCurrentMS() - begin;
+        SERVER_LOG_INFO(g_logger) << "close from plain thread: reader errno=" << result
+            << " woken after " << used << "ms";
+        SERVER_ASSERT(result == EBADF && used < 500);
+    }
+    close(fds[1]);
+}
+
+//close被推迟(还有在途调用)期间, 新的调用都应得到EBADF, 不能读到旧连接的数据
+void check_ebadf(int fd) {
+    char c = 0;
+    int flag = 1;
+    int on = 1;
+    int type = 0;
+    socklen_t len = sizeof(type);
+    errno = 0;
+    SERVER_ASSERT(read(fd, &c, 1) == -1 && errno == EBADF);
+    errno = 0;
+    SERVER_ASSERT(recv(fd, &c, 1, 0) == -1 && errno == EBADF);
+    errno = 0;
+    SERVER_ASSERT(fcntl(fd, F_GETFL) == -1 && errno == EBADF);
+    errno = 0;
+    SERVER_ASSERT(ioctl(fd, FIONBIO, &flag) == -1 && errno == EBADF);
+    errno = 0;
+    SERVER_ASSERT(setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) == -1 && errno == EBADF);
+    errno = 0;
+    SERVER_ASSERT(getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == -1 && errno == EBADF);
+}
+
+void test_call_while_closing() {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    //对端已写入数据, 旧实现会直接读到它
+    write(fds[1], "ab", 2);
+    //模拟一个长时间的在途调用(如交给线程池的文件读)
+    server::FdCtx* ctx = server::FdMgr::GetInstance()->get(fds[0], true);
+    SERVER_ASSERT(ctx && ctx->enter());
+    SERVER_ASSERT(close(fds[0]) == 0);
+    SERVER_ASSERT(server::FdMgr::GetInstance()->isClosing(fds[0]));
+
+    //未开启hook的线程
+    check_ebadf(fds[0]);
+    //IOManager中开启hook的协程
+    {
+        server::IOManager iom(1, false, "fd_closing");
+        int fd = fds[0];
+        iom.schedule([fd]() {
+            check_ebadf(fd);
+        });
+    }
+    ctx->leave();
+    SERVER_ASSERT(!server::FdMgr::GetInstance()->isClosing(fds[0]));
+    close(fds[1]);
+    SERVER_LOG_INFO(g_logger) << "calls during deferred close got EBADF";
+}
+
+int main() {
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+    test_close_from_thread();
+    test_call_while_closing();
+    server::IOManager iom(2, false, "fd_close");
+    iom.schedule(run);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#include "server/server.h"
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const int s_loops = 1000000;
+
+void bench_get_this() {
+    uint64_t begin = server::GetCurrentUS();
+    for(int i = 0; i < s_loops; ++i) {
+        server::Fiber::ptr cur = server::Fiber::GetThis();
+    }
+    uint64_t shared_us = server::GetCurrentUS() - begin;
+
+    begin = server::GetCurrentUS();
+    for(int i = 0; i < s_loops; ++i) {
+        server::Fiber* volatile cur = server::Fiber::GetThisRaw();
+        (void)cur;
+    }
+    uint64_t raw_us = server::GetCurrentUS() - begin;
+
+    SERVER_LOG_INFO(g_logger) << "GetThis: " << shared_us * 1000.0 / s_loops << " ns/call"
+        << " GetThisRaw: " << raw_us * 1000.0 / s_loops << " ns/call";
+}
+
+void bench_yield() {
+    uint64_t begin = server::GetCurrentUS();
+    for(int i = 0; i < s_loops; ++i) {
+        server::Fiber::YieldToReady();
+    }
+    uint64_t used_us = server::GetCurrentUS() - begin;
+    SERVER_LOG_INFO(g_logger) << "YieldToReady round trip: " << used_us * 1000.0 / s_loops << " ns/switch";
+}
+
+int main() {
+    g_logger->setLevel(server::LogLevel::INFO);
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+
+    server::Scheduler sc(1, false, "bench");
+    sc.start();
+    sc.schedule(&bench_get_this);
+    sc.schedule(&bench_yield);
+    sc.stop();
+    return 0;
+}
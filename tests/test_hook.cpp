@@ -1,6 +1,7 @@
 #include "server/hook.h"
 #include "server/iomanager.h"
 #include "server/log.h"
+#include "server/macro.h"
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <string.h>
@@ -65,11 +66,117 @@ void test_socket() {
     SERVER_LOG_INFO(g_logger) << "recv data=" << buffer;
 }
 
-int main() {
+static server::Fiber::ptr s_reader;
+static server::Fiber::ptr s_sleeper;
+
+void test_cancel() {
+    server::IOManager iom(1, false);
+    iom.schedule([]() {
+        int lfd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = 0;
+        inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr.s_addr);
+        socklen_t len = sizeof(addr);
+        bind(lfd, (const sockaddr*)&addr, sizeof(addr));
+        listen(lfd, 16);
+        getsockname(lfd, (sockaddr*)&addr, &len);
+
+        int cfd = socket(AF_INET, SOCK_STREAM, 0);
+        connect(cfd, (const sockaddr*)&addr, sizeof(addr));
+        s_reader = server::Fiber::GetThis();
+        char buf[16];
+        uint64_t begin = server::GetCurrentMS();
+        int ret = recv(cfd, buf, sizeof(buf), 0);
+        uint64_t used = server::GetCurrentMS() - begin;
+        SERVER_LOG_INFO(g_logger) << "recv ret=" << ret << " errno=" << errno
+            << " errstr=" << strerror(errno) << " used=" << used << "ms";
+        //100ms后被cancel唤醒
+        SERVER_ASSERT(ret == -1 && errno == ECANCELED);
+        SERVER_ASSERT(used >= 90 && used < 500);
+        close(cfd);
+        close(lfd);
+    });
+
+    iom.schedule([]() {
+        s_sleeper = server::Fiber::GetThis();
+        uint64_t begin = server::GetCurrentMS();
+        int ret = sleep(10);
+        uint64_t used = server::GetCurrentMS() - begin;
+        SERVER_LOG_INFO(g_logger) << "sleep ret=" << ret << " errno=" << errno
+            << " errstr=" << strerror(errno) << " used=" << used << "ms";
+        //被cancel提前唤醒, 返回剩余秒数
+        SERVER_ASSERT(ret > 0 && errno == ECANCELED);
+        SERVER_ASSERT(used >= 90 && used < 500);
+    });
+
+    iom.schedule([]() {
+        usleep(100 * 1000);
+        s_reader->cancel();
+        s_sleeper->cancel();
+        s_reader = nullptr;
+        s_sleeper = nullptr;
+    });
+}
+
+void test_deadline() {
+    server::IOManager iom(1, false);
+    iom.schedule([]() {
+        int lfd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = 0;
+        inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr.s_addr);
+        socklen_t len = sizeof(addr);
+        bind(lfd, (const sockaddr*)&addr, sizeof(addr));
+        listen(lfd, 16);
+        getsockname(lfd, (sockaddr*)&addr, &len);
+
+        int cfd = socket(AF_INET, SOCK_STREAM, 0);
+        connect(cfd, (const sockaddr*)&addr, sizeof(addr));
+
+        //整个请求预算200ms, 两次下游调用共享
+        uint64_t begin = server::GetCurrentMS();
+        server::Fiber::GetThis()->setDeadline(begin + 200);
+        usleep(120 * 1000);
+        char buf[16];
+        int ret = recv(cfd, buf, sizeof(buf), 0);
+        uint64_t used = server::GetCurrentMS() - begin;
+        SERVER_LOG_INFO(g_logger) << "recv ret=" << ret << " errno=" << errno
+            << " errstr=" << strerror(errno) << " used=" << used << "ms";
+        //recv只能用掉剩余的80ms, 不能再等完整的超时
+        SERVER_ASSERT(ret == -1 && errno == ETIMEDOUT);
+        SERVER_ASSERT(used >= 190 && used <= 200 + 20);
+        ret = sleep(1);
+        used = server::GetCurrentMS() - begin;
+        SERVER_LOG_INFO(g_logger) << "sleep ret=" << ret << " errno=" << errno
+            << " errstr=" << strerror(errno) << " used=" << used << "ms";
+        //预算已用完, sleep立即返回, 总耗时不超过预算(允许20ms调度误差)
+        SERVER_ASSERT(ret > 0 && errno == ETIMEDOUT);
+        SERVER_ASSERT(used <= 200 + 20);
+        server::Fiber::GetThis()->setDeadline(0);
+        close(cfd);
+        close(lfd);
+    });
+}
+
+//参数为socket/cancel/deadline时只运行对应的测试, 不带参数全部运行
+int main(int argc, char** argv) {
+    std::string which = argc > 1 ? argv[1] : "";
     // test_sleep();
-    server::IOManager iom;
-    iom.schedule(test_socket);
+    if(which.empty() || which == "socket") {
+        server::IOManager iom;
+        iom.schedule(test_socket);
+    }
     // test_socket();
+    if(which.empty() || which == "cancel") {
+        test_cancel();
+    }
+    if(which.empty() || which == "deadline") {
+        test_deadline();
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include "server/server.h"
+#include <chrono>
+#include <new>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static std::atomic<uint64_t> s_alloc_count {0};
+
+void* operator new(size_t size) {
+    ++s_alloc_count;
+    void* p = malloc(size);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+static const int s_loops = 200000;
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//每条日志的耗时和堆分配次数
+//先预热一轮: 线程缓冲区和异步队列各槽位的字符串空间在第一次使用时分配
+void bench(const std::string& name, server::Logger::ptr logger, bool fmt) {
+    for(int i = 0; i < s_loops; ++i) {
+        SERVER_LOG_INFO(logger) << "warm up " << i;
+    }
+    uint64_t allocs = s_alloc_count;
+    uint64_t begin = now_ns();
+    for(int i = 0; i < s_loops; ++i) {
+        if(fmt) {
+            SERVER_LOG_FMT_INFO(logger, "request %d from %s done, cost=%.3fms", i, "127.0.0.1", 1.5);
+        } else {
+            SERVER_LOG_INFO(logger) << "request " << i << " from " << "127.0.0.1"
+                << " done, cost=" << 1.5 << "ms";
+        }
+    }
+    uint64_t cost = now_ns() - begin;
+    allocs = s_alloc_count - allocs;
+    SERVER_LOG_INFO(g_logger) << name << ": " << cost / s_loops << " ns/log, "
+        << (double)allocs / s_loops << " allocs/log";
+}
+
+int main() {
+    server::Logger::ptr file(new server::Logger("file"));
+    file->addAppender(server::LogAppender::ptr(new server::FileLogAppender("/dev/null")));
+    bench("file stream", file, false);
+    bench("file fmt", file, true);
+
+    server::Logger::ptr async(new server::Logger("async"));
+    server::AsyncFileLogAppender::ptr appender(new server::AsyncFileLogAppender(
+                "/dev/null", 1 << 16, server::AsyncFileLogAppender::DROP));
+    async->addAppender(appender);
+    bench("async stream", async, false);
+    bench("async fmt", async, true);
+    SERVER_LOG_INFO(g_logger) << "async written=" << appender->getWritten()
+        << " dropped=" << appender->getDropped();
+    return 0;
+}
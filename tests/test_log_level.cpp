@@ -0,0 +1,119 @@
+//去掉DEBUG及以下的日志语句
+#define SERVER_LOG_MIN_LEVEL 2
+#include "server/server.h"
+#include <chrono>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const int s_loops = 10000000;
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//只计数的输出地
+class CountLogAppender : public server::LogAppender {
+public:
+    typedef std::shared_ptr<CountLogAppender> ptr;
+    void log(std::shared_ptr<server::Logger> logger, server::LogLevel::Level level
+            , server::LogEvent::ptr event) override {
+        if(level >= m_level) {
+            ++m_count;
+        }
+    }
+    std::string toYamlString() override { return ""; }
+    uint64_t getCount() const { return m_count; }
+private:
+    uint64_t m_count = 0;
+};
+
+//没有输出的日志的开销
+void bench_disabled() {
+    server::Logger::ptr logger(new server::Logger("level"));
+    logger->setLevel(server::LogLevel::ERROR);
+    volatile int v = 0;
+
+    uint64_t begin = now_ns();
+    for(int i = 0; i < s_loops; ++i) {
+        v = i;
+    }
+    uint64_t t_empty = now_ns() - begin;
+
+    //运行时比较日志器级别
+    begin = now_ns();
+    for(int i = 0; i < s_loops; ++i) {
+        SERVER_LOG_INFO(logger) << i;
+        v = i;
+    }
+    uint64_t t_level = now_ns() - begin;
+
+    //编译时去掉
+    begin = now_ns();
+    for(int i = 0; i < s_loops; ++i) {
+        SERVER_LOG_DEBUG(logger) << i;
+        v = i;
+    }
+    uint64_t t_removed = now_ns() - begin;
+    SERVER_LOG_INFO(g_logger) << "disabled log (" << s_loops << " loops): empty loop="
+        << t_empty / 1000000 << "ms level check=" << t_level / 1000000
+        << "ms compiled out=" << t_removed / 1000000 << "ms (" << v % 2 << ")";
+}
+
+static void log_info(server::Logger::ptr logger) {
+    SERVER_LOG_INFO(logger) << "info";
+}
+
+static void log_debug(server::Logger::ptr logger) {
+    SERVER_LOG_DEBUG(logger) << "debug";
+}
+
+//运行时改级别立即生效, 编译时去掉的不受影响
+void test_set_level() {
+    server::Logger::ptr logger(new server::Logger("level"));
+    CountLogAppender::ptr counter(new CountLogAppender);
+    logger->addAppender(counter);
+    log_info(logger);
+    logger->setLevel(server::LogLevel::WARN);
+    log_info(logger);
+    logger->setLevel(server::LogLevel::INFO);
+    log_info(logger);
+    //编译时已去掉
+    logger->setLevel(server::LogLevel::DEBUG);
+    log_debug(logger);
+    SERVER_LOG_INFO(g_logger) << "set level: count=" << counter->getCount();
+    SERVER_ASSERT(counter->getCount() == 2);
+}
+
+//logs配置变化后立即生效
+void test_config() {
+    auto set_level = [](const std::string& level) {
+        server::Config::LoadFromYaml(YAML::Load(
+                    "logs:\n  - name: level_conf\n    level: " + level + "\n"));
+    };
+    server::Logger::ptr logger = SERVER_LOG_NAME("level_conf");
+    CountLogAppender::ptr counter(new CountLogAppender);
+
+    set_level("error");
+    logger->addAppender(counter);
+    log_info(logger);
+    SERVER_ASSERT(counter->getCount() == 0);
+
+    set_level("info");
+    logger->addAppender(counter);
+    log_info(logger);
+    SERVER_ASSERT(counter->getCount() == 1);
+
+    set_level("fatal");
+    logger->addAppender(counter);
+    log_info(logger);
+    SERVER_LOG_INFO(g_logger) << "config: count=" << counter->getCount();
+    SERVER_ASSERT(counter->getCount() == 1);
+}
+
+int main() {
+    bench_disabled();
+    test_set_level();
+    test_config();
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "server/server.h"
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const std::string s_file = "/tmp/test_log_rotate.txt";
+
+static void cleanup() {
+    unlink(s_file.c_str());
+    unlink((s_file + ".moved").c_str());
+    for(int i = 1; i <= 8; ++i) {
+        unlink((s_file + "." + std::to_string(i)).c_str());
+    }
+}
+
+static int64_t file_size(const std::string& name) {
+    struct stat st;
+    if(stat(name.c_str(), &st)) {
+        return -1;
+    }
+    return st.st_size;
+}
+
+static server::Logger::ptr make_logger(server::LogAppender::ptr appender) {
+    server::Logger::ptr logger(new server::Logger("rotate"));
+    logger->addAppender(appender);
+    return logger;
+}
+
+//持续写3秒, 跨过多次秒边界
+void test_throughput() {
+    cleanup();
+    auto logger = make_logger(server::LogAppender::ptr(new server::FileLogAppender(s_file)));
+    uint64_t begin = server::GetCurrentMS();
+    uint64_t count = 0;
+    while(server::GetCurrentMS() - begin < 3000) {
+        for(int i = 0; i < 100; ++i) {
+            SERVER_LOG_INFO(logger) << "sustained throughput message " << count++;
+        }
+    }
+    SERVER_LOG_INFO(g_logger) << "sustained: " << count * 1000 / (server::GetCurrentMS() - begin)
+        << " logs/s, file size=" << file_size(s_file);
+}
+
+void test_size_rotate() {
+    cleanup();
+    auto logger = make_logger(server::LogAppender::ptr(
+                new server::FileLogAppender(s_file, 1024 * 1024, 0, 3)));
+    std::string payload(1000, 'x');
+    for(int i = 0; i < 6000; ++i) {
+        SERVER_LOG_INFO(logger) << payload;
+    }
+    logger->clearAppenders();
+    SERVER_LOG_INFO(g_logger) << "size rotate: current=" << file_size(s_file)
+        << " .1=" << file_size(s_file + ".1") << " .2=" << file_size(s_file + ".2")
+        << " .3=" << file_size(s_file + ".3") << " .4=" << file_size(s_file + ".4");
+    SERVER_ASSERT(file_size(s_file + ".3") > 0);
+    SERVER_ASSERT(file_size(s_file + ".4") == -1);
+}
+
+void test_interval_rotate() {
+    cleanup();
+    auto logger = make_logger(server::LogAppender::ptr(
+                new server::FileLogAppender(s_file, 0, 1, 3)));
+    for(int i = 0; i < 25; ++i) {
+        SERVER_LOG_INFO(logger) << "interval " << i;
+        usleep(100 * 1000);
+    }
+    logger->clearAppenders();
+    SERVER_LOG_INFO(g_logger) << "interval rotate: current=" << file_size(s_file)
+        << " .1=" << file_size(s_file + ".1") << " .2=" << file_size(s_file + ".2");
+    SERVER_ASSERT(file_size(s_file + ".2") > 0);
+}
+
+//外部工具移走文件后, 最迟1秒内写到新文件
+void test_moved() {
+    cleanup();
+    auto logger = make_logger(server::LogAppender::ptr(new server::FileLogAppender(s_file)));
+    SERVER_LOG_INFO(logger) << "before move";
+    rename(s_file.c_str(), (s_file + ".moved").c_str());
+    sleep(1);
+    SERVER_LOG_INFO(logger) << "after move";
+    logger->clearAppenders();
+    SERVER_LOG_INFO(g_logger) << "moved: new file size=" << file_size(s_file)
+        << " moved file size=" << file_size(s_file + ".moved");
+    SERVER_ASSERT(file_size(s_file) > 0);
+}
+
+//收到SIGHUP后下一条日志就写到新文件
+void test_signal() {
+    cleanup();
+    server::FileLogAppender::InstallReopenSignal(SIGHUP);
+    auto logger = make_logger(server::LogAppender::ptr(new server::FileLogAppender(s_file)));
+    SERVER_LOG_INFO(logger) << "before signal";
+    rename(s_file.c_str(), (s_file + ".moved").c_str());
+    raise(SIGHUP);
+    SERVER_LOG_INFO(logger) << "after signal";
+    logger->clearAppenders();
+    SERVER_LOG_INFO(g_logger) << "signal: new file size=" << file_size(s_file)
+        << " moved file size=" << file_size(s_file + ".moved");
+    SERVER_ASSERT(file_size(s_file) > 0);
+}
+
+int main() {
+    test_throughput();
+    test_size_rotate();
+    test_interval_rotate();
+    test_moved();
+    test_signal();
+    cleanup();
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "server/server.h"
+#include <chrono>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const int s_loops = 1000000;
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//取时间戳的开销
+void bench_clock() {
+    uint64_t sum = 0;
+    uint64_t begin = now_ns();
+    for(int i = 0; i < s_loops; ++i) {
+        sum += time(0);
+    }
+    uint64_t t_time = now_ns() - begin;
+
+    struct timespec ts;
+    begin = now_ns();
+    for(int i = 0; i < s_loops; ++i) {
+        clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        sum += ts.tv_sec;
+    }
+    uint64_t t_coarse = now_ns() - begin;
+
+    begin = now_ns();
+    for(int i = 0; i < s_loops; ++i) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        sum += ts.tv_sec;
+    }
+    uint64_t t_real = now_ns() - begin;
+    SERVER_LOG_INFO(g_logger) << "clock: time(0)=" << t_time / s_loops
+        << "ns CLOCK_REALTIME_COARSE=" << t_coarse / s_loops
+        << "ns CLOCK_REALTIME=" << t_real / s_loops << "ns (" << sum % 2 << ")";
+}
+
+//每行都调用localtime_r+strftime, 即原来的做法
+void bench_strftime() {
+    server::LogStream os;
+    uint64_t begin = now_ns();
+    for(int i = 0; i < s_loops; ++i) {
+        os.reset();
+        struct tm tm;
+        time_t t = time(0);
+        localtime_r(&t, &tm);
+        char buf[64];
+        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+        os << buf;
+    }
+    SERVER_LOG_INFO(g_logger) << "strftime every line: " << (now_ns() - begin) / s_loops << " ns/line";
+}
+
+void bench_formatter(const std::string& pattern) {
+    server::Logger::ptr logger(new server::Logger("time"));
+    server::LogFormatter fmt(pattern);
+    server::LogStream os;
+    server::LogEvent::ptr event = server::LogEvent::GetThreadEvent(logger,
+            server::LogLevel::INFO, __FILE__, __LINE__);
+    uint64_t begin = now_ns();
+    for(int i = 0; i < s_loops; ++i) {
+        os.reset();
+        fmt.format(os, logger, server::LogLevel::INFO, event);
+    }
+    SERVER_LOG_INFO(g_logger) << pattern << ": " << (now_ns() - begin) / s_loops
+        << " ns/line, sample=" << std::string(os.data(), os.size());
+}
+
+//创建事件的开销, 含取时间戳
+void bench_event() {
+    server::Logger::ptr logger(new server::Logger("time"));
+    uint64_t begin = now_ns();
+    for(int i = 0; i < s_loops; ++i) {
+        server::LogEvent::GetThreadEvent(logger, server::LogLevel::INFO, __FILE__, __LINE__);
+    }
+    SERVER_LOG_INFO(g_logger) << "GetThreadEvent: " << (now_ns() - begin) / s_loops << " ns";
+}
+
+int main() {
+    bench_clock();
+    bench_strftime();
+    bench_formatter("%d{%Y-%m-%d %H:%M:%S}");
+    bench_event();
+    bench_formatter("%d{%Y-%m-%d %H:%M:%S.%L}");
+    bench_formatter("%d{%H:%M:%S.%f}");
+    //有格式用到亚秒后改用精确时钟
+    bench_event();
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include "server/server.h"
+#include <string.h>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const int s_fibers = 2000;
+static const int s_rounds = 10;
+
+//每个协程在自己的栈上反复读写64KB, 中间多次让出, 观察恢复时是否回到栈所在节点
+void bench(bool affinity) {
+    server::Config::Lookup<bool>("scheduler.affinity.enable")->setValue(affinity);
+    server::Scheduler sc(4, false, affinity ? "pinned" : "free");
+    sc.start();
+    static std::atomic<uint64_t> s_sum {0};
+    uint64_t begin = server::GetCurrentUS();
+    for(int i = 0; i < s_fibers; ++i) {
+        sc.schedule([]() {
+            char buf[64 * 1024];
+            for(int r = 0; r < s_rounds; ++r) {
+                memset(buf, r, sizeof(buf));
+                uint64_t sum = 0;
+                for(size_t j = 0; j < sizeof(buf); j += 64) {
+                    sum += buf[j];
+                }
+                s_sum += sum;
+                server::Fiber::YieldToReady();
+            }
+        });
+    }
+    sc.stop();
+    uint64_t used = server::GetCurrentUS() - begin;
+    uint64_t local = sc.getNodeLocalRuns();
+    uint64_t remote = sc.getNodeRemoteRuns();
+    SERVER_LOG_INFO(g_logger) << (affinity ? "affinity on " : "affinity off") << ": "
+        << used / 1000 << "ms node_local=" << local << " node_remote=" << remote
+        << " local_ratio=" << (local + remote ? local * 100.0 / (local + remote) : 0) << "%";
+}
+
+int main(int argc, char** argv) {
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+    //argv[1]为模拟节点数, 单节点机器上默认模拟2个节点
+    server::Config::Lookup<uint32_t>("numa.simulate_nodes")->setValue(argc > 1 ? atoi(argv[1]) : 2);
+    SERVER_LOG_INFO(g_logger) << server::NumaMgr::GetInstance()->toString();
+    bench(false);
+    bench(true);
+    return 0;
+}
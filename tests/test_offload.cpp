@@ -0,0 +1,70 @@
+#include "server/server.h"
+#include "server/hook.h"
+#include <fcntl.h>
+#include <string.h>
+#include <stdexcept>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const char* s_path = "/tmp/test_offload.dat";
+static bool s_writing = false;
+static uint64_t s_max_gap_us = 0;
+static int s_ticks = 0;
+
+//一个协程写文件并fsync, 另一个协程每1ms醒来一次, 记录相邻两次醒来的最大间隔
+void bench(bool offload) {
+    server::Config::Lookup<bool>("hook.offload_file_io")->setValue(offload);
+    s_writing = true;
+    s_max_gap_us = 0;
+    s_ticks = 0;
+    uint64_t begin = server::GetCurrentUS();
+    {
+        server::IOManager iom(1, false, offload ? "offload" : "inline");
+        iom.schedule([]() {
+            int fd = open(s_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            std::string buf(1024 * 1024, 'x');
+            for(int i = 0; i < 32; ++i) {
+                write(fd, &buf[0], buf.size());
+                fsync(fd);
+            }
+            close(fd);
+            s_writing = false;
+        });
+        iom.schedule([]() {
+            uint64_t last = server::GetCurrentUS();
+            while(s_writing) {
+                usleep(1000);
+                uint64_t now = server::GetCurrentUS();
+                s_max_gap_us = std::max(s_max_gap_us, now - last);
+                last = now;
+                ++s_ticks;
+            }
+        });
+    }
+    SERVER_LOG_INFO(g_logger) << (offload ? "offload on " : "offload off") << ": write 32MB used "
+        << (server::GetCurrentUS() - begin) / 1000 << "ms ticker ran " << s_ticks
+        << " times, max gap " << s_max_gap_us / 1000.0 << "ms";
+}
+
+void test_exception() {
+    server::IOManager iom(1, false, "except");
+    iom.schedule([]() {
+        try {
+            server::OffloadMgr::GetInstance()->offload([]() {
+                throw std::runtime_error("offload error");
+            });
+        } catch (std::exception& e) {
+            SERVER_LOG_INFO(g_logger) << "caught in fiber: " << e.what();
+        }
+    });
+}
+
+int main() {
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+    bench(false);
+    bench(true);
+    test_exception();
+    SERVER_LOG_INFO(g_logger) << "offloaded calls: " << server::OffloadMgr::GetInstance()->getOffloadCount();
+    unlink(s_path);
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include "server/server.h"
+#include "server/hook.h"
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <poll.h>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static int s_ticks = 0;
+
+//模拟同一线程上的其他协程, poll阻塞线程时计数不会增加
+void ticker(int n) {
+    for(int i = 0; i < n; ++i) {
+        usleep(10 * 1000);
+        ++s_ticks;
+    }
+}
+
+//第三方库常见写法: 非阻塞fd + poll等待
+void test_poll() {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    server::IOManager::GetThis()->schedule([fds]() {
+        usleep(100 * 1000);
+        write(fds[1], "x", 1);
+    });
+    server::IOManager::GetThis()->schedule(std::bind(ticker, 10));
+
+    s_ticks = 0;
+    struct pollfd pfd = {fds[0], POLLIN, 0};
+    uint64_t begin = server::GetCurrentMS();
+    int rt = poll(&pfd, 1, 1000);
+    SERVER_LOG_INFO(g_logger) << "poll rt=" << rt << " revents=" << pfd.revents
+        << " used=" << server::GetCurrentMS() - begin << "ms ticks=" << s_ticks;
+
+    pfd.revents = 0;
+    char c;
+    read(fds[0], &c, 1);
+    begin = server::GetCurrentMS();
+    rt = poll(&pfd, 1, 50);
+    SERVER_LOG_INFO(g_logger) << "poll timeout rt=" << rt
+        << " used=" << server::GetCurrentMS() - begin << "ms";
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void test_select() {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    server::IOManager::GetThis()->schedule([fds]() {
+        usleep(50 * 1000);
+        write(fds[1], "x", 1);
+    });
+    server::IOManager::GetThis()->schedule(std::bind(ticker, 5));
+
+    s_ticks = 0;
+    fd_set rset;
+    FD_ZERO(&rset);
+    FD_SET(fds[0], &rset);
+    struct timeval tv = {1, 0};
+    uint64_t begin = server::GetCurrentMS();
+    int rt = select(fds[0] + 1, &rset, nullptr, nullptr, &tv);
+    SERVER_LOG_INFO(g_logger) << "select rt=" << rt << " isset=" << FD_ISSET(fds[0], &rset)
+        << " used=" << server::GetCurrentMS() - begin << "ms left=" << tv.tv_sec * 1000 + tv.tv_usec / 1000
+        << "ms ticks=" << s_ticks;
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void test_epoll_wait() {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    int epfd = epoll_create(1);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fds[0];
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &ev);
+    server::IOManager::GetThis()->schedule([fds]() {
+        usleep(50 * 1000);
+        write(fds[1], "x", 1);
+    });
+    server::IOManager::GetThis()->schedule(std::bind(ticker, 5));
+
+    s_ticks = 0;
+    struct epoll_event out[4];
+    uint64_t begin = server::GetCurrentMS();
+    int rt = epoll_wait(epfd, out, 4, 1000);
+    SERVER_LOG_INFO(g_logger) << "epoll_wait rt=" << rt << " fd=" << (rt > 0 ? out[0].data.fd : -1)
+        << " used=" << server::GetCurrentMS() - begin << "ms ticks=" << s_ticks;
+    close(epfd);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+//截止时间到达时poll返回ETIMEDOUT
+void test_poll_deadline() {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    struct pollfd pfd = {fds[0], POLLIN, 0};
+    server::Fiber::GetThis()->setDeadline(server::GetCurrentMS() + 30);
+    uint64_t begin = server::GetCurrentMS();
+    int rt = poll(&pfd, 1, -1);
+    SERVER_LOG_INFO(g_logger) << "poll deadline rt=" << rt << " errno=" << errno
+        << " used=" << server::GetCurrentMS() - begin << "ms";
+    server::Fiber::GetThis()->setDeadline(0);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+//多个协程poll同一fd: 先超时的只删除自己的等待, 数据到达时其他协程都立即被唤醒
+void test_poll_shared() {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    static std::atomic<int> s_done {0};
+    static uint64_t s_used[3];
+    s_done = 0;
+    uint64_t begin = server::GetCurrentMS();
+    int timeouts[3] = {20, 1000, 1000};
+    for(int i = 0; i < 3; ++i) {
+        int to = timeouts[i];
+        int fd = fds[0];
+        server::IOManager::GetThis()->schedule([i, to, fd, begin]() {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            poll(&pfd, 1, to);
+            s_used[i] = server::GetCurrentMS() - begin;
+            ++s_done;
+        });
+    }
+    //再加一个hook的read和poll共用读事件, 它只读走一个字节
+    static int s_read_rt = 0;
+    server::IOManager::GetThis()->schedule([fds]() {
+        char c;
+        s_read_rt = read(fds[0], &c, 1);
+        ++s_done;
+    });
+    usleep(100 * 1000);
+    write(fds[1], "xy", 2);
+    while(s_done < 4) {
+        usleep(1000);
+    }
+    SERVER_LOG_INFO(g_logger) << "poll shared: used=" << s_used[0] << "/" << s_used[1] << "/"
+        << s_used[2] << "ms read rt=" << s_read_rt;
+    SERVER_ASSERT(s_used[0] < 80);
+    SERVER_ASSERT(s_used[1] >= 100 && s_used[1] < 300);
+    SERVER_ASSERT(s_used[2] >= 100 && s_used[2] < 300);
+    SERVER_ASSERT(s_read_rt == 1);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void run() {
+    test_poll();
+    test_select();
+    test_epoll_wait();
+    test_poll_deadline();
+    test_poll_shared();
+}
+
+int main() {
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+    server::IOManager iom(1, false, "poll");
+    iom.schedule(run);
+    return 0;
+}
@@ -13,7 +13,7 @@ void test_fiber() {
     
 }
 
-int main() {
+void test_schedule() {
     SERVER_LOG_INFO(g_logger) << "main";
     server::Scheduler sc(1, true, "test");
     sc.start();
@@ -22,5 +22,294 @@ int main() {
     SERVER_LOG_INFO(g_logger) << "stop";
     sc.stop();
     SERVER_LOG_INFO(g_logger) << "over";
+}
+
+void test_fiber_pool() {
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+    server::Scheduler sc(2, false, "pool");
+    sc.start();
+    for(int i = 0; i < 10000; ++i) {
+        sc.schedule([i]() {
+            if(i % 2) {
+                server::Fiber::YieldToReady();
+            }
+        });
+    }
+    sc.stop();
+    SERVER_LOG_INFO(g_logger) << "fiber pool hits=" << sc.getFiberPoolHits()
+        << " misses=" << sc.getFiberPoolMisses();
+    SERVER_ASSERT(sc.getFiberPoolHits() + sc.getFiberPoolMisses() == 10000);
+    //让出的任务协程还没结束, 只能新建; 不让出的任务除了每个线程第一个都应命中
+    SERVER_ASSERT(sc.getFiberPoolMisses() <= 5000 + 2);
+}
+
+//结束后仍被持有的协程不能回收给其他任务
+void test_fiber_pool_held() {
+    server::Scheduler sc(1, false, "pool_held");
+    static server::Fiber::ptr s_held;
+    static std::set<server::Fiber*> s_used;
+    sc.schedule([]() {
+        s_held = server::Fiber::GetThis();
+    });
+    for(int i = 0; i < 100; ++i) {
+        sc.schedule([]() {
+            s_used.insert(server::Fiber::GetThis().get());
+        });
+    }
+    sc.start();
+    sc.stop();
+    SERVER_LOG_INFO(g_logger) << "held fiber state=" << s_held->getState()
+        << " reused=" << s_used.count(s_held.get());
+    SERVER_ASSERT(s_held->getState() == server::Fiber::TERM);
+    SERVER_ASSERT(s_used.count(s_held.get()) == 0);
+    s_held.reset();
+}
+
+void test_priority() {
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+    //这里只验证优先级顺序, 放宽防饿死阈值
+    server::Config::Lookup<uint32_t>("scheduler.priority.max_wait_ms")->setValue(1000);
+    server::Scheduler sc(1, false, "priority");
+    static int s_first_high = -1;
+    static int s_last_high = -1;
+    static int s_seq = 0;
+    for(int i = 0; i < 1000; ++i) {
+        sc.schedule([]() { ++s_seq; }, -1, server::Fiber::LOW);
+    }
+    for(int i = 0; i < 10; ++i) {
+        sc.schedule([]() {
+            if(s_first_high < 0) {
+                s_first_high = s_seq;
+            }
+            s_last_high = s_seq;
+            ++s_seq;
+        }, -1, server::Fiber::HIGH);
+    }
+    sc.start();
+    sc.stop();
+    server::Config::Lookup<uint32_t>("scheduler.priority.max_wait_ms")->setValue(100);
+    SERVER_LOG_INFO(g_logger) << "first high task ran after " << s_first_high << " tasks, last after " << s_last_high;
+    const char* names[] = {"HIGH", "NORMAL", "LOW"};
+    for(int i = 0; i < server::Fiber::PRIORITY_NUM; ++i) {
+        auto stats = sc.getPriorityStats((server::Fiber::Priority)i);
+        SERVER_LOG_INFO(g_logger) << names[i] << " depth=" << stats.depth
+            << " dequeued=" << stats.dequeued
+            << " avg_wait_us=" << (stats.dequeued ? stats.totalWaitUs / stats.dequeued : 0)
+            << " max_wait_us=" << stats.maxWaitUs;
+    }
+    //后入队的10个HIGH任务先于所有LOW任务执行
+    SERVER_ASSERT(s_first_high == 0 && s_last_high == 9);
+    SERVER_ASSERT(sc.getPriorityStats(server::Fiber::HIGH).dequeued == 10);
+    SERVER_ASSERT(sc.getPriorityStats(server::Fiber::LOW).dequeued == 1000);
+}
+
+static uint64_t s_flood_end_us = 0;
+
+//HIGH任务不断把自己重新放入队列, 队列中始终有HIGH任务
+void flood_high() {
+    uint64_t end = server::GetCurrentUS() + 1000;
+    while(server::GetCurrentUS() < end);
+    if(server::GetCurrentUS() < s_flood_end_us) {
+        server::Scheduler::GetThis()->schedule(&flood_high, -1, server::Fiber::HIGH);
+    }
+}
+
+//HIGH持续涌入时, LOW任务等待超过max_wait后仍能执行
+void test_priority_starvation() {
+    server::Config::Lookup<uint32_t>("scheduler.priority.max_wait_ms")->setValue(20);
+    server::Scheduler sc(1, false, "starvation");
+    static uint64_t s_low_wait_us = 0;
+    static bool s_during_flood = false;
+    uint64_t begin = server::GetCurrentUS();
+    s_flood_end_us = begin + 300 * 1000;
+    sc.schedule(&flood_high, -1, server::Fiber::HIGH);
+    sc.schedule(&flood_high, -1, server::Fiber::HIGH);
+    sc.schedule([begin]() {
+        uint64_t now = server::GetCurrentUS();
+        s_low_wait_us = now - begin;
+        s_during_flood = now < s_flood_end_us;
+    }, -1, server::Fiber::LOW);
+    sc.start();
+    sc.stop();
+    server::Config::Lookup<uint32_t>("scheduler.priority.max_wait_ms")->setValue(100);
+    SERVER_LOG_INFO(g_logger) << "low task ran after " << s_low_wait_us / 1000 << "ms during high flood: "
+        << s_during_flood << " high dequeued=" << sc.getPriorityStats(server::Fiber::HIGH).dequeued;
+    SERVER_ASSERT(s_during_flood && s_low_wait_us < 100 * 1000);
+}
+
+void test_watchdog() {
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+    server::Config::Lookup<uint32_t>("scheduler.watchdog.budget_ms")->setValue(20);
+    server::Scheduler sc(1, false, "watchdog");
+    static int s_yields = 0;
+    static uint64_t s_short_done_us = 0;
+    uint64_t begin = server::GetCurrentUS();
+    sc.start();
+    //计算密集任务, 每轮调用检查点
+    sc.schedule([]() {
+        uint64_t end = server::GetCurrentUS() + 200 * 1000;
+        while(server::GetCurrentUS() < end) {
+            if(server::Scheduler::IsOverBudget()) {
+                ++s_yields;
+            }
+            server::Fiber::MaybeYield();
+        }
+    });
+    sc.schedule([]() {
+        s_short_done_us = server::GetCurrentUS();
+    });
+    sc.stop();
+    server::Config::Lookup<uint32_t>("scheduler.watchdog.budget_ms")->setValue(0);
+    SERVER_LOG_INFO(g_logger) << "busy fiber yielded " << s_yields << " times, short task ran after "
+        << (s_short_done_us - begin) / 1000 << "ms";
+}
+
+//记录system日志的内容
+class CaptureLogAppender : public server::LogAppender {
+public:
+    typedef std::shared_ptr<CaptureLogAppender> ptr;
+    void log(std::shared_ptr<server::Logger> logger, server::LogLevel::Level level
+            , server::LogEvent::ptr event) override {
+        server::Mutex::Lock lock(m_mutex);
+        m_text += event->getContent();
+    }
+    std::string toYamlString() override { return ""; }
+    std::string getText() {
+        server::Mutex::Lock lock(m_mutex);
+        return m_text;
+    }
+private:
+    server::Mutex m_mutex;
+    std::string m_text;
+};
+
+//默认由协程在检查点记录自己的调用栈
+void busy_with_checkpoint() {
+    uint64_t end = server::GetCurrentUS() + 100 * 1000;
+    while(server::GetCurrentUS() < end) {
+        server::Fiber::MaybeYield();
+    }
+}
+
+//不调用检查点的协程, 只有开启signal_stack时watchdog才能取到它的调用栈
+void busy_no_checkpoint() {
+    uint64_t end = server::GetCurrentUS() + 200 * 1000;
+    while(server::GetCurrentUS() < end);
+}
+
+//在watchdog下运行cb, 返回期间system日志的内容
+std::string run_watched(bool signal_stack, std::function<void()> cb) {
+    server::Config::Lookup<uint32_t>("scheduler.watchdog.budget_ms")->setValue(20);
+    server::Config::Lookup<bool>("scheduler.watchdog.signal_stack")->setValue(signal_stack);
+    CaptureLogAppender::ptr capture(new CaptureLogAppender);
+    SERVER_LOG_NAME("system")->addAppender(capture);
+    {
+        server::Scheduler sc(1, false, "watchdog_stack");
+        sc.start();
+        sc.schedule(cb);
+        sc.stop();
+    }
+    SERVER_LOG_NAME("system")->delAppender(capture);
+    server::Config::Lookup<uint32_t>("scheduler.watchdog.budget_ms")->setValue(0);
+    server::Config::Lookup<bool>("scheduler.watchdog.signal_stack")->setValue(false);
+    return capture->getText();
+}
+
+void test_watchdog_stack() {
+    std::string text = run_watched(false, &busy_with_checkpoint);
+    bool has_stack = text.find("busy_with_checkpoint") != std::string::npos;
+    SERVER_LOG_INFO(g_logger) << "stack logged at checkpoint: " << has_stack;
+    SERVER_ASSERT(has_stack);
+
+    text = run_watched(true, &busy_no_checkpoint);
+    has_stack = text.find("busy_no_checkpoint") != std::string::npos;
+    SERVER_LOG_INFO(g_logger) << "watchdog signal captured stack of stuck fiber: " << has_stack;
+    SERVER_ASSERT(has_stack);
+
+    //取栈信号不能改变被打断的阻塞调用的结果: 普通Scheduler中的usleep是原始调用
+    static int s_rt = -1;
+    static uint64_t s_used_ms = 0;
+    text = run_watched(true, []() {
+        uint64_t begin = server::GetCurrentMS();
+        s_rt = usleep(300 * 1000);
+        s_used_ms = server::GetCurrentMS() - begin;
+    });
+    SERVER_LOG_INFO(g_logger) << "usleep under watchdog signal rt=" << s_rt << " used=" << s_used_ms << "ms";
+    SERVER_ASSERT(text.find("watchdog: fiber_id") != std::string::npos);
+    SERVER_ASSERT(s_rt == 0 && s_used_ms >= 300);
+}
+
+void test_elastic() {
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+    server::Config::Lookup<bool>("scheduler.elastic.enable")->setValue(true);
+    server::Config::Lookup<uint32_t>("scheduler.elastic.max_threads")->setValue(4);
+    server::Config::Lookup<uint32_t>("scheduler.elastic.scale_up_wait_ms")->setValue(5);
+    server::Config::Lookup<uint32_t>("scheduler.elastic.idle_cooldown_ms")->setValue(200);
+    server::Scheduler sc(1, false, "elastic");
+    static std::atomic<size_t> s_peak {0};
+    static server::Scheduler* s_sc = &sc;
+    sc.start();
+    uint64_t begin = server::GetCurrentUS();
+    for(int i = 0; i < 40; ++i) {
+        sc.schedule([]() {
+            uint64_t end = server::GetCurrentUS() + 20 * 1000;
+            while(server::GetCurrentUS() < end);
+            size_t n = s_sc->getThreadCount();
+            if(n > s_peak) {
+                s_peak = n;
+            }
+        });
+    }
+    while(sc.getPriorityStats(server::Fiber::NORMAL).dequeued < 40) {
+        usleep(1000);
+    }
+    uint64_t used = server::GetCurrentUS() - begin;
+    usleep(600 * 1000);
+    SERVER_LOG_INFO(g_logger) << "elastic: 40 x 20ms tasks used " << used / 1000 << "ms peak_threads="
+        << s_peak << " threads_after_idle=" << sc.getThreadCount();
+    sc.stop();
+    server::Config::Lookup<bool>("scheduler.elastic.enable")->setValue(false);
+}
+
+//唯一的工作线程一直卡在长任务中, 没有线程取任务, 也要扩容
+void test_elastic_stuck() {
+    server::Config::Lookup<bool>("scheduler.elastic.enable")->setValue(true);
+    server::Config::Lookup<uint32_t>("scheduler.elastic.max_threads")->setValue(4);
+    server::Config::Lookup<uint32_t>("scheduler.elastic.scale_up_wait_ms")->setValue(5);
+    server::Scheduler sc(1, false, "elastic_stuck");
+    static std::atomic<int> s_started {0};
+    static std::atomic<uint64_t> s_last_start_us {0};
+    sc.start();
+    uint64_t begin = server::GetCurrentUS();
+    for(int i = 0; i < 4; ++i) {
+        sc.schedule([]() {
+            ++s_started;
+            s_last_start_us = server::GetCurrentUS();
+            uint64_t end = server::GetCurrentUS() + 300 * 1000;
+            while(server::GetCurrentUS() < end);
+        });
+    }
+    while(s_started < 4) {
+        usleep(1000);
+    }
+    sc.stop();
+    uint64_t all_started_ms = (s_last_start_us - begin) / 1000;
+    SERVER_LOG_INFO(g_logger) << "elastic stuck: 4 x 300ms tasks all started after "
+        << all_started_ms << "ms";
+    SERVER_ASSERT(s_started == 4);
+    SERVER_ASSERT(all_started_ms < 200);
+    server::Config::Lookup<bool>("scheduler.elastic.enable")->setValue(false);
+}
+
+int main() {
+    test_schedule();
+    test_fiber_pool();
+    test_fiber_pool_held();
+    test_priority();
+    test_priority_starvation();
+    test_watchdog();
+    test_watchdog_stack();
+    test_elastic();
+    test_elastic_stuck();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,132 @@
+#include "server/server.h"
+#include "server/hook.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const char* s_path = "/tmp/test_sendfile.dat";
+static const size_t s_file_size = 64 * 1024 * 1024;
+static const int s_loops = 4;
+
+enum Mode {
+    READ_WRITE,
+    SENDFILE,
+    SPLICE
+};
+
+static sockaddr_in s_addr;
+static int s_listen = -1;
+static Mode s_mode;
+static uint64_t s_received = 0;
+
+void serve(int sock) {
+    int fd = open(s_path, O_RDONLY);
+    if(s_mode == READ_WRITE) {
+        std::string buf(64 * 1024, '\0');
+        ssize_t n = 0;
+        while((n = read(fd, &buf[0], buf.size())) > 0) {
+            ssize_t off = 0;
+            while(off < n) {
+                ssize_t w = write(sock, &buf[off], n - off);
+                if(w <= 0) {
+                    break;
+                }
+                off += w;
+            }
+        }
+    } else if(s_mode == SENDFILE) {
+        off_t off = 0;
+        while(off < (off_t)s_file_size) {
+            if(sendfile(sock, fd, &off, s_file_size - off) <= 0) {
+                break;
+            }
+        }
+    } else {
+        //文件 -> 管道 -> socket
+        int pipes[2];
+        pipe(pipes);
+        loff_t off = 0;
+        while(off < (loff_t)s_file_size) {
+            ssize_t n = splice(fd, &off, pipes[1], nullptr, 64 * 1024, SPLICE_F_MOVE);
+            if(n <= 0) {
+                break;
+            }
+            while(n > 0) {
+                ssize_t w = splice(pipes[0], nullptr, sock, nullptr, n, SPLICE_F_MOVE);
+                if(w <= 0) {
+                    break;
+                }
+                n -= w;
+            }
+        }
+        close(pipes[0]);
+        close(pipes[1]);
+    }
+    close(fd);
+    close(sock);
+}
+
+void client() {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    connect(sock, (const sockaddr*)&s_addr, sizeof(s_addr));
+    std::string buf(256 * 1024, '\0');
+    ssize_t n = 0;
+    while((n = recv(sock, &buf[0], buf.size(), 0)) > 0) {
+        s_received += n;
+    }
+    close(sock);
+}
+
+void bench(Mode mode, const char* name) {
+    s_mode = mode;
+    s_received = 0;
+    uint64_t begin = server::GetCurrentUS();
+    {
+        server::IOManager iom(1, false, name);
+        iom.schedule([]() {
+            for(int i = 0; i < s_loops; ++i) {
+                int sock = accept(s_listen, nullptr, nullptr);
+                server::IOManager::GetThis()->schedule(std::bind(serve, sock));
+            }
+        });
+        for(int i = 0; i < s_loops; ++i) {
+            iom.schedule(client);
+        }
+    }
+    uint64_t used = server::GetCurrentUS() - begin;
+    SERVER_LOG_INFO(g_logger) << name << ": " << s_received / 1024 / 1024 << "MB in " << used / 1000
+        << "ms " << s_received * 1.0 / used << " MB/s";
+}
+
+int main() {
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+    int fd = open(s_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    std::string block(1024 * 1024, 'x');
+    for(size_t i = 0; i < s_file_size / block.size(); ++i) {
+        write(fd, &block[0], block.size());
+    }
+    close(fd);
+
+    s_listen = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&s_addr, 0, sizeof(s_addr));
+    s_addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &s_addr.sin_addr.s_addr);
+    socklen_t len = sizeof(s_addr);
+    bind(s_listen, (const sockaddr*)&s_addr, sizeof(s_addr));
+    listen(s_listen, 128);
+    getsockname(s_listen, (sockaddr*)&s_addr, &len);
+
+    server::Config::Lookup<bool>("hook.offload_file_io")->setValue(false);
+    bench(READ_WRITE, "read+write");
+    server::Config::Lookup<bool>("hook.offload_file_io")->setValue(true);
+    bench(READ_WRITE, "read+write(offload)");
+    bench(SENDFILE, "sendfile");
+    bench(SPLICE, "splice");
+
+    close(s_listen);
+    unlink(s_path);
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include "server/server.h"
+#include "server/hook.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const int s_packets = 200000;
+static const size_t s_packet_size = 64;
+
+static sockaddr_in s_addr;
+static size_t s_batch = 1;
+static uint64_t s_received = 0;
+static uint64_t s_calls = 0;
+static uint64_t s_first_us = 0;
+static uint64_t s_last_us = 0;
+
+void receiver() {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int rcvbuf = 8 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    //发送结束后100ms收不到数据即退出
+    timeval tv = {0, 100 * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    bind(sock, (const sockaddr*)&s_addr, sizeof(s_addr));
+    socklen_t len = sizeof(s_addr);
+    getsockname(sock, (sockaddr*)&s_addr, &len);
+
+    server::UdpBatch batch(s_batch, 2048);
+    //发送端在独立的线程中(未开启hook), 模拟外部上报方
+    server::Thread::ptr sender(new server::Thread([]() {
+        int sock = socket(AF_INET, SOCK_DGRAM, 0);
+        connect(sock, (const sockaddr*)&s_addr, sizeof(s_addr));
+        server::UdpBatch out(s_batch, s_packet_size);
+        char payload[s_packet_size];
+        memset(payload, 'm', sizeof(payload));
+        for(int i = 0; i < s_packets; ) {
+            for(size_t j = 0; j < s_batch && i < s_packets; ++j, ++i) {
+                out.add(payload, sizeof(payload));
+            }
+            out.send(sock);
+        }
+        close(sock);
+    }, "udp_sender"));
+
+    while(true) {
+        int n = batch.recv(sock);
+        if(n <= 0) {
+            break;
+        }
+        if(!s_first_us) {
+            s_first_us = server::GetCurrentUS();
+        }
+        s_last_us = server::GetCurrentUS();
+        s_received += n;
+        ++s_calls;
+    }
+    sender->join();
+    close(sock);
+}
+
+void bench(size_t batch) {
+    s_batch = batch;
+    s_received = s_calls = s_first_us = s_last_us = 0;
+    memset(&s_addr, 0, sizeof(s_addr));
+    s_addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &s_addr.sin_addr.s_addr);
+    {
+        server::IOManager iom(1, false, "udp");
+        iom.schedule(receiver);
+    }
+    uint64_t used = s_last_us > s_first_us ? s_last_us - s_first_us : 1;
+    SERVER_LOG_INFO(g_logger) << "batch=" << batch << ": received " << s_received << "/" << s_packets
+        << " in " << used / 1000 << "ms " << (uint64_t)(s_received * 1000000.0 / used) << " pkt/s "
+        << (s_calls ? s_received * 1.0 / s_calls : 0) << " pkt/recv";
+}
+
+//recvmmsg的timeout参数作为截止时间, 比SO_RCVTIMEO短时先到
+void test_recvmmsg_timeout() {
+    server::IOManager iom(1, false, "udp_timeout");
+    iom.schedule([]() {
+        int sock = socket(AF_INET, SOCK_DGRAM, 0);
+        timeval tv = {1, 0};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr.s_addr);
+        bind(sock, (const sockaddr*)&addr, sizeof(addr));
+
+        char buf[64];
+        iovec iov = {buf, sizeof(buf)};
+        mmsghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_hdr.msg_iov = &iov;
+        msg.msg_hdr.msg_iovlen = 1;
+        timespec timeout = {0, 100 * 1000 * 1000};
+        uint64_t begin = server::GetCurrentMS();
+        int n = recvmmsg(sock, &msg, 1, 0, &timeout);
+        uint64_t used = server::GetCurrentMS() - begin;
+        SERVER_LOG_INFO(g_logger) << "recvmmsg timeout: ret=" << n << " errno=" << errno
+            << " errstr=" << strerror(errno) << " used=" << used << "ms";
+        SERVER_ASSERT(n == -1 && errno == ETIMEDOUT);
+        SERVER_ASSERT(used >= 90 && used < 500);
+        SERVER_ASSERT(timeout.tv_sec == 0 && timeout.tv_nsec < 100 * 1000 * 1000);
+        close(sock);
+    });
+}
+
+int main() {
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+    test_recvmmsg_timeout();
+    bench(1);
+    bench(8);
+    bench(64);
+    return 0;
+}
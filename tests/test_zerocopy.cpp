@@ -0,0 +1,150 @@
+#include "server/server.h"
+#include "server/hook.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+
+static server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const size_t s_chunk_size = 256 * 1024;
+static const size_t s_total_size = 1024 * 1024 * 1024;
+
+static sockaddr_in s_addr;
+static int s_listen = -1;
+static bool s_zerocopy = false;
+static uint64_t s_received = 0;
+
+void serve(int sock) {
+    //数据不再修改, 发送中的缓冲区可以直接复用
+    std::string buf(s_chunk_size, 'z');
+    if(!s_zerocopy) {
+        size_t sent = 0;
+        while(sent < s_total_size) {
+            ssize_t n = send(sock, &buf[0], std::min(buf.size(), s_total_size - sent), 0);
+            if(n <= 0) {
+                break;
+            }
+            sent += n;
+        }
+        close(sock);
+        return;
+    }
+
+    uint64_t released = 0;
+    server::ZeroCopySender sender(sock);
+    for(size_t sent = 0; sent < s_total_size; sent += buf.size()) {
+        if(sender.send(&buf[0], buf.size(), [&released]() { ++released; }) < 0) {
+            break;
+        }
+    }
+    sender.flush();
+    SERVER_LOG_INFO(g_logger) << "zerocopy=" << sender.isZeroCopy() << " released=" << released
+        << " completed=" << sender.getCompleted() << " copied=" << sender.getCopied();
+    close(sock);
+}
+
+void client() {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    connect(sock, (const sockaddr*)&s_addr, sizeof(s_addr));
+    std::string buf(s_chunk_size, '\0');
+    ssize_t n = 0;
+    while((n = recv(sock, &buf[0], buf.size(), 0)) > 0) {
+        s_received += n;
+    }
+    close(sock);
+}
+
+void bench(bool zerocopy, const char* name) {
+    s_zerocopy = zerocopy;
+    s_received = 0;
+    uint64_t begin = server::GetCurrentUS();
+    {
+        server::IOManager iom(1, false, name);
+        iom.schedule([]() {
+            int sock = accept(s_listen, nullptr, nullptr);
+            serve(sock);
+        });
+        iom.schedule(client);
+    }
+    uint64_t used = server::GetCurrentUS() - begin;
+    SERVER_LOG_INFO(g_logger) << name << ": " << s_received / 1024 / 1024 << "MB in " << used / 1000
+        << "ms " << s_received * 1.0 / used << " MB/s";
+}
+
+//应答用zerocopy发出后接着读下一个请求: 完成通知未取走期间, 读等待者不能被反复唤醒
+static int s_reader_wakeups = 0;
+static bool s_reader_done = false;
+
+void reader(int sock) {
+    char c = 0;
+    while(true) {
+        ssize_t n = recv_f(sock, &c, 1, MSG_DONTWAIT);
+        if(n >= 0 || errno != EAGAIN) {
+            break;
+        }
+        server::IOManager::GetThis()->addEvent(sock, server::IOManager::READ);
+        server::Fiber::YieldToHold();
+        ++s_reader_wakeups;
+    }
+    s_reader_done = true;
+}
+
+void test_concurrent_reader() {
+    static bool s_zc = false;
+    {
+        server::IOManager iom(1, false, "zc_reader");
+        iom.schedule([]() {
+            int sock = accept(s_listen, nullptr, nullptr);
+            server::ZeroCopySender sender(sock);
+            s_zc = sender.isZeroCopy();
+            server::IOManager::GetThis()->schedule(std::bind(reader, sock));
+            static std::string resp(4096, 'r');
+            sender.send(&resp[0], resp.size(), nullptr);
+            //不调用flush, 完成通知留在错误队列中
+            while(!s_reader_done) {
+                usleep(10 * 1000);
+            }
+            sender.flush();
+            close(sock);
+        });
+        iom.schedule([]() {
+            int sock = socket(AF_INET, SOCK_STREAM, 0);
+            connect(sock, (const sockaddr*)&s_addr, sizeof(s_addr));
+            std::string buf(4096, '\0');
+            size_t got = 0;
+            while(got < buf.size()) {
+                ssize_t n = recv(sock, &buf[got], buf.size() - got, 0);
+                if(n <= 0) {
+                    break;
+                }
+                got += n;
+            }
+            //对端空闲一段时间后才发下一个请求
+            usleep(200 * 1000);
+            send(sock, "q", 1, 0);
+            while(recv(sock, &buf[0], buf.size(), 0) > 0);
+            close(sock);
+        });
+    }
+    SERVER_LOG_INFO(g_logger) << "zerocopy=" << s_zc << " reader wakeups while idle: " << s_reader_wakeups;
+    SERVER_ASSERT(s_reader_done && s_reader_wakeups <= 3);
+}
+
+int main() {
+    SERVER_LOG_NAME("system")->setLevel(server::LogLevel::WARN);
+    s_listen = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&s_addr, 0, sizeof(s_addr));
+    s_addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &s_addr.sin_addr.s_addr);
+    socklen_t len = sizeof(s_addr);
+    bind(s_listen, (const sockaddr*)&s_addr, sizeof(s_addr));
+    listen(s_listen, 128);
+    getsockname(s_listen, (sockaddr*)&s_addr, &len);
+
+    bench(false, "send");
+    bench(true, "zerocopy");
+    test_concurrent_reader();
+
+    close(s_listen);
+    return 0;
+}
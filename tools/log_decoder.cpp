@@ -0,0 +1,36 @@
+#include "server/server.h"
+
+//把BinaryLogAppender写出的二进制日志按LogFormatter的格式还原为文本
+//用法: log_decoder <file> [pattern]
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <file> [pattern]" << std::endl;
+        return 1;
+    }
+    std::string pattern = "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n";
+    if(argc > 2) {
+        pattern = argv[2];
+    }
+    server::LogFormatter fmt(pattern);
+    if(fmt.isError()) {
+        std::cerr << "invalid pattern: " << pattern << std::endl;
+        return 1;
+    }
+
+    server::BinaryLogReader reader;
+    if(!reader.open(argv[1])) {
+        std::cerr << "open " << argv[1] << " fail" << std::endl;
+        return 1;
+    }
+    server::LogEvent::ptr event;
+    uint64_t count = 0;
+    while(reader.next(event)) {
+        fmt.format(std::cout, event->getLogger(), event->getLevel(), event);
+        ++count;
+    }
+    if(reader.isError()) {
+        std::cerr << argv[1] << ": corrupted after " << count << " events" << std::endl;
+        return 1;
+    }
+    return 0;
+}